@@ -42,9 +42,37 @@ KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
 KNOB<INT32> KnobAnalysisTool(KNOB_MODE_WRITEONCE, "pintool",
     "tool", "0", "analysis tool to be used. See README for more information.");
 
+KNOB<string> KnobFilterImgInclude(KNOB_MODE_APPEND, "pintool",
+    "img_include", "", "only instrument images matching this glob (may be repeated).");
+
+KNOB<string> KnobFilterImgExclude(KNOB_MODE_APPEND, "pintool",
+    "img_exclude", "", "do not instrument images matching this glob (may be repeated).");
+
+KNOB<string> KnobFilterRtnInclude(KNOB_MODE_APPEND, "pintool",
+    "rtn_include", "", "only instrument routines matching this glob (may be repeated).");
+
+KNOB<string> KnobFilterRtnExclude(KNOB_MODE_APPEND, "pintool",
+    "rtn_exclude", "", "do not instrument routines matching this glob (may be repeated).");
+
+KNOB<string> KnobFilterRange(KNOB_MODE_APPEND, "pintool",
+    "addr_range", "", "only instrument code in this address range, given as lo-hi (may be repeated).");
+
+KNOB<UINT32> KnobTopN(KNOB_MODE_WRITEONCE, "pintool",
+    "topn", "50", "number of entries in top-N reports.");
+
+KNOB<UINT32> KnobSampleWindow(KNOB_MODE_WRITEONCE, "pintool",
+    "sample_window", "0", "length in ms of the instrumented sampling windows of tools 1 and 2. 0 instruments the whole run.");
+
+KNOB<UINT32> KnobSampleDuty(KNOB_MODE_WRITEONCE, "pintool",
+    "sample_duty", "10", "percentage of the run time that is instrumented when sampling.");
+
+KNOB<BOOL> KnobToolReg(KNOB_MODE_WRITEONCE, "pintool",
+    "tls_reg", "1", "keep the per-thread data pointer in a Pin scratch register instead of looking it up in TLS.");
+
 INT32 gPinPid = 0;
 
 // The outfile
+string OutFileName;
 ofstream OutFile;
 PIN_LOCK OutFileLock;
 
@@ -57,6 +85,48 @@ const char * StripPath(const char * path)
         return path;
 }
 
+// Locations resolved while their image was loaded, guarded by the client
+// lock. Reports come at Fini, when images closed with dlclose are gone.
+static std::map<ADDRINT, string> SourceLocations;
+
+// Called with the client lock held
+static string SourceLocation_Resolve(ADDRINT address)
+{
+    INT32 column = 0;
+    INT32 line = 0;
+    string file;
+    string rtnName = "?";
+    string imgName = "?";
+
+    RTN rtn = RTN_FindByAddress(address);
+    if ( RTN_Valid(rtn) )
+        rtnName = RTN_Name(rtn);
+    IMG img = IMG_FindByAddress(address);
+    if ( IMG_Valid(img) )
+        imgName = StripPath(IMG_Name(img).c_str());
+    PIN_GetSourceLocation(address, &column, &line, &file);
+
+    // Demangled C++ names may contain commas
+    return "\"" + rtnName + "\"," + imgName + "," + (file.empty() ? "?" : StripPath(file.c_str())) + "," + decstr(line);
+}
+
+VOID SourceLocation_Record(ADDRINT address)
+{
+    PIN_LockClient();
+    if ( SourceLocations.find(address) == SourceLocations.end() )
+        SourceLocations[address] = SourceLocation_Resolve(address);
+    PIN_UnlockClient();
+}
+
+string SourceLocation(ADDRINT address)
+{
+    PIN_LockClient();
+    std::map<ADDRINT, string>::iterator it = SourceLocations.find(address);
+    string location = it != SourceLocations.end() ? it->second : SourceLocation_Resolve(address);
+    PIN_UnlockClient();
+    return location;
+}
+
 //
 // Tool registration implementation
 //
@@ -89,6 +159,20 @@ void register_tools()
     register_tool(inscount_ext);
     register_tool(proccount);
     register_tool(malloctrace);
+    register_tool(bblprof);
+    register_tool(callgraph);
+    register_tool(objprof);
+    register_tool(footprint);
+    register_tool(cachesim);
+    register_tool(falseshare);
+    register_tool(reuse);
+    register_tool(workingset);
+    register_tool(stride);
+    register_tool(numa);
+    register_tool(lockprof);
+    register_tool(branchsim);
+    register_tool(loopprof);
+    register_tool(roofline);
 }
 
 /* ===================================================================== */
@@ -121,11 +205,15 @@ int main(int argc, char * argv[])
     char *outFileName = new char[KnobOutputFile.Value().size()+10];
     sprintf(outFileName, "%s_%d", KnobOutputFile.Value().c_str(), gPinPid);
 
+    OutFileName = outFileName;
     OutFile.open(outFileName);
 
     // We need a lock for the output file
     InitLock(&OutFileLock);
 
+    // Instrumentation filters are shared by all tools
+    Filter_Init();
+
     // Start PinTool
     register_tools();
     start_tool(KnobAnalysisTool.Value());
@@ -36,7 +36,11 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
 #include <vector>
+#include <map>
+#include <algorithm>
 
 #include <fstream>
 #include <iostream>
@@ -48,12 +52,32 @@ using namespace std;
 
 /** Our includes */
 #include "mempin_utils.h"
+#include "mempin_counters.h"
+#include "mempin_filter.h"
 #include "mempin_tools.h"
 
 // The process pid
 extern INT32 gPinPid;
 
-// The output file
+// Use a scratch register for per-thread data
+extern KNOB<BOOL> KnobToolReg;
+
+// Instrumentation filters
+extern KNOB<string> KnobFilterImgInclude;
+extern KNOB<string> KnobFilterImgExclude;
+extern KNOB<string> KnobFilterRtnInclude;
+extern KNOB<string> KnobFilterRtnExclude;
+extern KNOB<string> KnobFilterRange;
+
+// Number of entries of top-N reports
+extern KNOB<UINT32> KnobTopN;
+
+// Sampling of the instruction counters
+extern KNOB<UINT32> KnobSampleWindow;
+extern KNOB<UINT32> KnobSampleDuty;
+
+// The output file, tools with more than one report put the others next to it
+extern string OutFileName;
 extern ofstream OutFile;
 extern PIN_LOCK OutFileLock;
 
@@ -62,6 +86,15 @@ extern PIN_LOCK OutFileLock;
 
 /** Strip path from string */
 const char * StripPath(const char * path);
+
+// CSV columns written by SourceLocation
+#define SOURCE_LOCATION_HEADER "Routine,Image,File,Line"
+
+/** Routine, image and source line of a code address as CSV columns */
+string SourceLocation(ADDRINT address);
+
+/** Resolve the source location now, while the image of the address is still loaded */
+VOID SourceLocation_Record(ADDRINT address);
 //
 // Tool register. Just a list of function pointers which will the
 // initialize the actual tool
@@ -0,0 +1,163 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_bblprof.h"
+
+//
+// Tool Registration
+//
+
+BOOL bblprof(INT32 toolId)
+{
+    if ( toolId == TOOL_BBLPROF )
+    {
+        LOGI("Registering callbacks for bblprof");
+
+        // Per-thread counters of inscount
+        Inscount_Init();
+
+        // Count the instructions and each BBL on its own
+        TRACE_AddInstrumentFunction(Inscount_Trace, reinterpret_cast<VOID*>(Bblprof_Bbl));
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(Bblprof_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// Bblprof implementation
+//
+// Every distinct BBL gets an id at instrumentation time. The execution
+// counters live in each thread's thread_data_t, so the analysis routine
+// never takes a lock; they get merged at Fini.
+
+// All BBLs seen so far, indexed by id
+static std::vector<bblprof_block_t> BblList;
+
+// Id of each BBL. The same address can start BBLs of different length
+// in different traces, so both make up the key.
+static std::map<std::pair<ADDRINT, UINT32>, UINT32> BblIds;
+
+VOID PIN_FAST_ANALYSIS_CALL bblprof_docount(UINT32 id, THREADID threadid)
+{
+    thread_data_t* tdata = get_tls(threadid);
+    tdata->_bbls[id]++;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL bblprof_docount_reg(UINT32 id, thread_data_t* tdata)
+{
+    tdata->_bbls[id]++;
+}
+
+// Instrumentation runs serialized by Pin, no need to lock the BBL list
+VOID Bblprof_Bbl(BBL bbl)
+{
+    std::pair<ADDRINT, UINT32> key(BBL_Address(bbl), BBL_NumIns(bbl));
+    std::map<std::pair<ADDRINT, UINT32>, UINT32>::iterator it = BblIds.find(key);
+    UINT32 id;
+
+    if ( it != BblIds.end() )
+    {
+        id = it->second;
+    }
+    else
+    {
+        if ( BblList.size() >= COUNTER_MAX_ID )
+        {
+            WARN("Too many BBLs, " << hexstr(key.first) << " will not be profiled");
+            return;
+        }
+
+        bblprof_block_t block;
+        block._address = key.first;
+        block._numIns = key.second;
+        id = BblList.size();
+        BblList.push_back(block);
+        SourceLocation_Record(block._address);
+        BblIds[key] = id;
+    }
+
+    REG reg = Inscount_ToolReg();
+    if ( REG_valid(reg) )
+        BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)bblprof_docount_reg, IARG_FAST_ANALYSIS_CALL,
+                       IARG_UINT32, id, IARG_REG_VALUE, reg, IARG_END);
+    else
+        BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)bblprof_docount, IARG_FAST_ANALYSIS_CALL,
+                       IARG_UINT32, id, IARG_THREAD_ID, IARG_END);
+}
+
+// Order blocks by dynamic instruction count, highest first
+static bool Bblprof_Compare(const std::pair<UINT64, UINT32> &a, const std::pair<UINT64, UINT32> &b)
+{
+    return a.first > b.first;
+}
+
+// This function is called when the application exits
+VOID Bblprof_Fini(INT32 code, VOID *v)
+{
+    // Merge the counters of all threads
+    std::vector< std::pair<UINT64, UINT32> > hot;
+    UINT64 total = 0;
+    for (UINT32 id = 0; id < BblList.size(); id++)
+    {
+        UINT64 execs = 0;
+        for (INT32 t=0; t<numThreads; t++)
+            execs += get_tls(t)->_bbls.get(id);
+        if ( execs == 0 )
+            continue;
+
+        UINT64 ins = execs * BblList[id]._numIns;
+        hot.push_back(std::make_pair(ins, id));
+        total += ins;
+    }
+
+    UINT32 topN = std::min((size_t)KnobTopN.Value(), hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + topN, hot.end(), Bblprof_Compare);
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    // Write to a file since cout and cerr maybe closed by the application
+    OutFile << "Rank,Address,Instructions,Executions,BblSize,Share," << SOURCE_LOCATION_HEADER << endl;
+
+    for (UINT32 i = 0; i < topN; i++)
+    {
+        bblprof_block_t &block = BblList[hot[i].second];
+        OutFile << i+1 << "," << hexstr(block._address) << "," << hot[i].first << ","
+                << hot[i].first / block._numIns << "," << block._numIns << ","
+                << (double)hot[i].first / total << "," << SourceLocation(block._address) << endl;
+    }
+
+    Filter_Report(OutFile);
+    OutFile.close();
+    ReleaseLock(&OutFileLock);
+}
@@ -0,0 +1,447 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_branchsim.h"
+
+KNOB<UINT32> KnobBranchBits(KNOB_MODE_WRITEONCE, "pintool",
+    "bp_bits", "12", "log2 of the entries of each predictor table.");
+
+KNOB<UINT32> KnobBranchHistory(KNOB_MODE_WRITEONCE, "pintool",
+    "bp_history", "12", "global history bits of gshare.");
+
+KNOB<string> KnobBranchModel(KNOB_MODE_WRITEONCE, "pintool",
+    "bp_model", "tage", "model that ranks the branches: bimodal, gshare or tage.");
+
+//
+// Tool Registration
+//
+
+BOOL branchsim(INT32 toolId)
+{
+    if ( toolId == TOOL_BRANCHSIM )
+    {
+        LOGI("Registering callbacks for branchsim");
+
+        // Per-thread data of inscount
+        Inscount_Init();
+
+        BranchSim_Init();
+        PIN_AddThreadStartFunction(BranchSim_ThreadStart, 0);
+        TRACE_AddInstrumentFunction(BranchSim_Trace, 0);
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(BranchSim_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// Branch predictor implementation
+//
+// Every conditional branch outcome goes through three direction
+// predictors at once: a bimodal table of 2 bit counters indexed by the
+// address, gshare which hashes the global history into the index, and a
+// small TAGE with a bimodal base and tagged tables of geometric history
+// lengths, where the longest matching table provides the prediction.
+//
+// Indirect branches have no direction, only a target. Their target comes
+// from a BTB holding the last target of the address (reported in the
+// bimodal column) and from a target cache indexed by address and history
+// (reported as gshare and tage). Returns are left out, a return stack
+// predicts them almost perfectly.
+//
+// History and tables are per thread, as if each thread had a core of its
+// own.
+
+static const char* BranchModelNames[BP_MODELS] = { "Bimodal", "Gshare", "Tage" };
+
+static const UINT32 TageHistory[BP_TAGE_TABLES] = { 5, 12, 24, 48 };
+
+// Static branches by id, only grows at instrumentation time
+static std::vector<branch_ins_t> BranchTable;
+
+// Id of each branch, so a retranslated branch keeps its id
+static std::map<ADDRINT, UINT32> BranchIds;
+
+static UINT32 TableBits = 12;
+static UINT64 TableMask = 0;
+static UINT64 HistoryMask = 0;
+static UINT32 RankModel = BP_TAGE;
+
+// Model names are matched ignoring case
+static BOOL BranchSim_IsModel(const string &name, const char *model)
+{
+    if ( name.size() != strlen(model) )
+        return FALSE;
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        if ( tolower((unsigned char)name[i]) != tolower((unsigned char)model[i]) )
+            return FALSE;
+    }
+    return TRUE;
+}
+
+VOID BranchSim_Init()
+{
+    TableBits = std::max(std::min(KnobBranchBits.Value(), 24U), 4U);
+    TableMask = (1ULL << TableBits) - 1;
+    UINT32 history = std::min(KnobBranchHistory.Value(), 63U);
+    HistoryMask = (1ULL << history) - 1;
+
+    RankModel = BP_MODELS;
+    for (UINT32 m = 0; m < BP_MODELS; m++)
+    {
+        if ( BranchSim_IsModel(KnobBranchModel.Value(), BranchModelNames[m]) )
+            RankModel = m;
+    }
+    if ( RankModel == BP_MODELS )
+    {
+        ERROR("Unknown branch model: " << KnobBranchModel.Value() << ", ranking by " << BranchModelNames[BP_TAGE]);
+        RankModel = BP_TAGE;
+    }
+}
+
+static branch_thread_t* get_branchsim(THREADID threadid)
+{
+    return static_cast<branch_thread_t*>(get_tls(threadid)->_tool);
+}
+
+VOID BranchSim_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    UINT32 entries = 1 << TableBits;
+    branch_thread_t* bt = new branch_thread_t();
+
+    // Counters start weakly not taken
+    bt->_bimodal = new UINT8[entries];
+    bt->_gshare = new UINT8[entries];
+    bt->_tageBase = new UINT8[entries];
+    std::fill(bt->_bimodal, bt->_bimodal + entries, 1);
+    std::fill(bt->_gshare, bt->_gshare + entries, 1);
+    std::fill(bt->_tageBase, bt->_tageBase + entries, 1);
+
+    // The tagged tables share the budget of one table
+    for (UINT32 i = 0; i < BP_TAGE_TABLES; i++)
+        bt->_tage[i] = new tage_entry_t[entries / BP_TAGE_TABLES]();
+
+    bt->_btb = new ADDRINT[entries]();
+    bt->_targets = new ADDRINT[entries]();
+    get_tls(threadid)->_tool = bt;
+}
+
+static inline VOID BranchSim_Counter(UINT8 &ctr, BOOL taken)
+{
+    if ( taken )
+        ctr += ctr < 3;
+    else
+        ctr -= ctr > 0;
+}
+
+// Folds the youngest bits of the history down to the given width
+static inline UINT64 BranchSim_Fold(UINT64 history, UINT32 length, UINT32 bits)
+{
+    history &= (length < 64) ? (1ULL << length) - 1 : ~0ULL;
+    UINT64 folded = 0;
+    for (UINT32 b = 0; b < length; b += bits)
+        folded ^= history >> b;
+    return folded & ((1ULL << bits) - 1);
+}
+
+static inline BOOL BranchSim_Tage(branch_thread_t* bt, ADDRINT pc, BOOL taken)
+{
+    UINT32 indexBits = TableBits - 2;
+    UINT32 index[BP_TAGE_TABLES];
+    UINT16 tag[BP_TAGE_TABLES];
+    INT32 provider = -1;
+    INT32 alternate = -1;
+
+    for (INT32 i = BP_TAGE_TABLES - 1; i >= 0; i--)
+    {
+        index[i] = (pc ^ (pc >> indexBits) ^ BranchSim_Fold(bt->_history, TageHistory[i], indexBits)) & ((1ULL << indexBits) - 1);
+        tag[i] = (pc ^ BranchSim_Fold(bt->_history, TageHistory[i], BP_TAGE_TAG_BITS)
+                    ^ (BranchSim_Fold(bt->_history, TageHistory[i], BP_TAGE_TAG_BITS - 1) << 1)) & ((1 << BP_TAGE_TAG_BITS) - 1);
+        if ( bt->_tage[i][index[i]]._tag == tag[i] )
+        {
+            if ( provider < 0 )
+                provider = i;
+            else if ( alternate < 0 )
+                alternate = i;
+        }
+    }
+
+    UINT8 &base = bt->_tageBase[pc & TableMask];
+    BOOL basePrediction = base >= 2;
+    BOOL alternatePrediction = alternate >= 0 ? bt->_tage[alternate][index[alternate]]._ctr >= 0 : basePrediction;
+    BOOL prediction = basePrediction;
+
+    if ( provider >= 0 )
+    {
+        tage_entry_t &entry = bt->_tage[provider][index[provider]];
+        prediction = entry._ctr >= 0;
+
+        // Usefulness only changes when the provider made the difference
+        if ( prediction != alternatePrediction )
+        {
+            if ( prediction == taken )
+                entry._useful += entry._useful < 3;
+            else
+                entry._useful -= entry._useful > 0;
+        }
+        if ( taken )
+            entry._ctr += entry._ctr < 3;
+        else
+            entry._ctr -= entry._ctr > -4;
+    }
+    else
+        BranchSim_Counter(base, taken);
+
+    // On a miss try a longer history, taking an entry nobody finds useful
+    if ( prediction != taken )
+    {
+        BOOL allocated = FALSE;
+        for (INT32 i = provider + 1; i < BP_TAGE_TABLES && !allocated; i++)
+        {
+            tage_entry_t &entry = bt->_tage[i][index[i]];
+            if ( entry._useful == 0 )
+            {
+                entry._tag = tag[i];
+                entry._ctr = taken ? 0 : -1;
+                allocated = TRUE;
+            }
+        }
+        for (INT32 i = provider + 1; i < BP_TAGE_TABLES && !allocated; i++)
+            bt->_tage[i][index[i]]._useful--;
+    }
+
+    if ( ++bt->_tageUpdates % BP_TAGE_RESET == 0 )
+    {
+        for (UINT32 i = 0; i < BP_TAGE_TABLES; i++)
+        {
+            for (UINT32 e = 0; e < (1U << indexBits); e++)
+                bt->_tage[i][e]._useful = 0;
+        }
+    }
+    return prediction;
+}
+
+static inline VOID BranchSim_Conditional(branch_thread_t* bt, UINT32 id, ADDRINT pc, BOOL taken)
+{
+    branch_site_t &site = bt->_sites[id];
+    site._count++;
+    site._taken += taken;
+
+    UINT8 &bimodal = bt->_bimodal[pc & TableMask];
+    site._misses[BP_BIMODAL] += (bimodal >= 2) != taken;
+    BranchSim_Counter(bimodal, taken);
+
+    UINT8 &gshare = bt->_gshare[(pc ^ (bt->_history & HistoryMask)) & TableMask];
+    site._misses[BP_GSHARE] += (gshare >= 2) != taken;
+    BranchSim_Counter(gshare, taken);
+
+    site._misses[BP_TAGE] += BranchSim_Tage(bt, pc, taken) != taken;
+
+    bt->_history = (bt->_history << 1) | (taken ? 1 : 0);
+}
+
+static inline VOID BranchSim_Indirect(branch_thread_t* bt, UINT32 id, ADDRINT pc, ADDRINT target)
+{
+    branch_site_t &site = bt->_sites[id];
+    site._count++;
+    site._taken++;
+
+    ADDRINT &last = bt->_btb[pc & TableMask];
+    site._misses[BP_BIMODAL] += last != target;
+    last = target;
+
+    ADDRINT &cached = bt->_targets[(pc ^ (bt->_history & HistoryMask)) & TableMask];
+    site._misses[BP_GSHARE] += cached != target;
+    site._misses[BP_TAGE] += cached != target;
+    cached = target;
+
+    // The target goes into the history so the next ones correlate with it
+    bt->_history = (bt->_history << 2) | ((target >> 2) & 3);
+}
+
+VOID branchsim_conditional(UINT32 id, ADDRINT pc, BOOL taken, THREADID threadid)
+{
+    BranchSim_Conditional(get_branchsim(threadid), id, pc, taken);
+}
+
+VOID branchsim_conditional_reg(UINT32 id, ADDRINT pc, BOOL taken, thread_data_t* tdata)
+{
+    BranchSim_Conditional(static_cast<branch_thread_t*>(tdata->_tool), id, pc, taken);
+}
+
+VOID branchsim_indirect(UINT32 id, ADDRINT pc, ADDRINT target, THREADID threadid)
+{
+    BranchSim_Indirect(get_branchsim(threadid), id, pc, target);
+}
+
+VOID branchsim_indirect_reg(UINT32 id, ADDRINT pc, ADDRINT target, thread_data_t* tdata)
+{
+    BranchSim_Indirect(static_cast<branch_thread_t*>(tdata->_tool), id, pc, target);
+}
+
+VOID BranchSim_Trace(TRACE trace, VOID *v)
+{
+    REG reg = Inscount_ToolReg();
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if ( !Filter_Bbl(bbl) )
+            continue;
+
+        // Only the tail of a block branches
+        INS ins = BBL_InsTail(bbl);
+        BOOL conditional = INS_IsBranch(ins) && INS_HasFallThrough(ins);
+        BOOL indirect = INS_IsIndirectBranchOrCall(ins) && !INS_IsRet(ins);
+        if ( !conditional && !indirect )
+            continue;
+
+        ADDRINT address = INS_Address(ins);
+        std::map<ADDRINT, UINT32>::iterator it = BranchIds.find(address);
+        UINT32 id;
+
+        if ( it != BranchIds.end() )
+        {
+            id = it->second;
+        }
+        else
+        {
+            if ( BranchTable.size() >= COUNTER_MAX_ID )
+                continue;
+
+            branch_ins_t bi;
+            bi._address = address;
+            bi._indirect = !conditional;
+            id = BranchTable.size();
+            BranchTable.push_back(bi);
+            SourceLocation_Record(address);
+            BranchIds[address] = id;
+        }
+
+        if ( conditional )
+        {
+            if ( REG_valid(reg) )
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)branchsim_conditional_reg,
+                               IARG_UINT32, id, IARG_ADDRINT, address, IARG_BRANCH_TAKEN,
+                               IARG_REG_VALUE, reg, IARG_END);
+            else
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)branchsim_conditional,
+                               IARG_UINT32, id, IARG_ADDRINT, address, IARG_BRANCH_TAKEN,
+                               IARG_THREAD_ID, IARG_END);
+        }
+        else
+        {
+            if ( REG_valid(reg) )
+                INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)branchsim_indirect_reg,
+                                         IARG_UINT32, id, IARG_ADDRINT, address, IARG_BRANCH_TARGET_ADDR,
+                                         IARG_REG_VALUE, reg, IARG_END);
+            else
+                INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)branchsim_indirect,
+                                         IARG_UINT32, id, IARG_ADDRINT, address, IARG_BRANCH_TARGET_ADDR,
+                                         IARG_THREAD_ID, IARG_END);
+        }
+    }
+}
+
+static bool BranchSim_Compare(const std::pair<UINT64, UINT32> &a, const std::pair<UINT64, UINT32> &b)
+{
+    return a.first > b.first;
+}
+
+VOID BranchSim_Fini(INT32 code, VOID *v)
+{
+    std::vector<branch_site_t> sites(BranchTable.size());
+    branch_site_t totals[2];
+    memset(totals, 0, sizeof(totals));
+
+    for (INT32 t = 0; t < numThreads; t++)
+    {
+        branch_thread_t* bt = get_branchsim(t);
+        for (UINT32 id = 0; id < BranchTable.size(); id++)
+        {
+            const branch_site_t *s = bt->_sites.find(id);
+            if ( !s || !s->_count )
+                continue;
+
+            branch_site_t &total = totals[BranchTable[id]._indirect ? 1 : 0];
+            sites[id]._count += s->_count;
+            sites[id]._taken += s->_taken;
+            total._count += s->_count;
+            total._taken += s->_taken;
+            for (UINT32 m = 0; m < BP_MODELS; m++)
+            {
+                sites[id]._misses[m] += s->_misses[m];
+                total._misses[m] += s->_misses[m];
+            }
+        }
+    }
+
+    // Sites by mispredictions of the ranking model
+    std::vector< std::pair<UINT64, UINT32> > hot;
+    for (UINT32 id = 0; id < BranchTable.size(); id++)
+    {
+        if ( sites[id]._misses[RankModel] )
+            hot.push_back(std::make_pair(sites[id]._misses[RankModel], id));
+    }
+    UINT32 topN = std::min((size_t)KnobTopN.Value(), hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + topN, hot.end(), BranchSim_Compare);
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    OutFile << "Kind,Model,Executions,Mispredictions,Rate" << endl;
+    for (UINT32 k = 0; k < 2; k++)
+    {
+        for (UINT32 m = 0; m < BP_MODELS; m++)
+        {
+            OutFile << (k ? "Indirect," : "Conditional,") << BranchModelNames[m] << "," << totals[k]._count << ","
+                    << totals[k]._misses[m] << "," << (totals[k]._count ? (double)totals[k]._misses[m] / totals[k]._count : 0) << endl;
+        }
+    }
+
+    OutFile << endl << "Rank,Ip,Kind,Executions,Taken,Bimodal,Gshare,Tage,Rate," << SOURCE_LOCATION_HEADER << endl;
+    for (UINT32 i = 0; i < topN; i++)
+    {
+        UINT32 id = hot[i].second;
+        branch_site_t &s = sites[id];
+
+        OutFile << i+1 << "," << hexstr(BranchTable[id]._address) << "," << (BranchTable[id]._indirect ? "Indirect" : "Conditional")
+                << "," << s._count << "," << s._taken;
+        for (UINT32 m = 0; m < BP_MODELS; m++)
+            OutFile << "," << s._misses[m];
+        OutFile << "," << (double)s._misses[RankModel] / s._count << "," << SourceLocation(BranchTable[id]._address) << endl;
+    }
+
+    Filter_Report(OutFile);
+    OutFile.close();
+    ReleaseLock(&OutFileLock);
+}
@@ -0,0 +1,104 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_BRANCHSIM_H
+#define MEMPIN_BRANCHSIM_H
+
+//
+// Tool entry points
+//
+
+BOOL branchsim(INT32 toolId);
+
+// Predictor models, simulated side by side
+#define BP_BIMODAL 0
+#define BP_GSHARE 1
+#define BP_TAGE 2
+#define BP_MODELS 3
+
+// Tagged tables of the TAGE model and the width of their tags
+#define BP_TAGE_TABLES 4
+#define BP_TAGE_TAG_BITS 10
+
+// Useful bits of the TAGE model are cleared every that many branches
+#define BP_TAGE_RESET (1 << 18)
+
+// Static branch
+typedef struct BranchIns
+{
+    ADDRINT _address;
+    BOOL _indirect;
+} branch_ins_t;
+
+// Branch stats of one site in one thread
+typedef struct BranchSite
+{
+    UINT64 _count;
+    UINT64 _taken;
+    UINT64 _misses[BP_MODELS];
+} branch_site_t;
+
+// Entry of a tagged TAGE table
+typedef struct TageEntry
+{
+    UINT16 _tag;
+    INT8 _ctr;                  // 3 bit signed, taken when >= 0
+    UINT8 _useful;
+} tage_entry_t;
+
+// Per-thread state, kept in thread_data_t::_tool. Each thread runs its
+// own predictors like a core would.
+typedef struct BranchThread
+{
+    UINT64 _history;            // global history, newest outcome in bit 0
+    UINT8 *_bimodal;            // 2 bit counters
+    UINT8 *_gshare;
+    UINT8 *_tageBase;
+    tage_entry_t *_tage[BP_TAGE_TABLES];
+    UINT64 _tageUpdates;
+    ADDRINT *_btb;              // last target by address
+    ADDRINT *_targets;          // target by address and history
+    chunked_table_t<branch_site_t> _sites;
+} branch_thread_t;
+
+/** Reads the knobs */
+VOID BranchSim_Init();
+
+/** Thread start callback, sets up the predictor tables */
+VOID BranchSim_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
+
+/** Trace instrumentation, hooks conditional and indirect branches */
+VOID BranchSim_Trace(TRACE trace, VOID *v);
+
+/** Finish callback */
+VOID BranchSim_Fini(INT32 code, VOID *v);
+
+#endif // MEMPIN_BRANCHSIM_H
@@ -0,0 +1,387 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_cachesim.h"
+
+#include <stddef.h>
+
+KNOB<UINT32> KnobCacheLine(KNOB_MODE_WRITEONCE, "pintool",
+    "cache_line", "64", "cache line size in bytes.");
+
+KNOB<UINT32> KnobCacheL1Size(KNOB_MODE_WRITEONCE, "pintool",
+    "cache_l1_size", "32768", "L1D size in bytes.");
+
+KNOB<UINT32> KnobCacheL1Assoc(KNOB_MODE_WRITEONCE, "pintool",
+    "cache_l1_assoc", "8", "L1D associativity.");
+
+KNOB<UINT32> KnobCacheL2Size(KNOB_MODE_WRITEONCE, "pintool",
+    "cache_l2_size", "262144", "L2 size in bytes.");
+
+KNOB<UINT32> KnobCacheL2Assoc(KNOB_MODE_WRITEONCE, "pintool",
+    "cache_l2_assoc", "8", "L2 associativity.");
+
+KNOB<UINT32> KnobCacheLlcSize(KNOB_MODE_WRITEONCE, "pintool",
+    "cache_llc_size", "8388608", "shared last level cache size in bytes.");
+
+KNOB<UINT32> KnobCacheLlcAssoc(KNOB_MODE_WRITEONCE, "pintool",
+    "cache_llc_assoc", "16", "shared last level cache associativity.");
+
+KNOB<string> KnobCachePolicy(KNOB_MODE_WRITEONCE, "pintool",
+    "cache_policy", "lru", "replacement policy of all levels: lru or plru.");
+
+//
+// Tool Registration
+//
+
+BOOL cachesim(INT32 toolId)
+{
+    if ( toolId == TOOL_CACHESIM )
+    {
+        LOGI("Registering callbacks for cachesim");
+
+        // Per-thread data of inscount
+        Inscount_Init();
+
+        // Shared LLC and the per-thread reference buffers
+        Cachesim_Init();
+        PIN_AddThreadStartFunction(Cachesim_ThreadStart, 0);
+        TRACE_AddInstrumentFunction(Cachesim_Trace, 0);
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(Cachesim_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// Cache simulator implementation
+//
+// Instrumented code only appends each memory reference to a per-thread
+// trace buffer, Pin inlines that. When the buffer is full (and when the
+// thread exits) the whole batch goes through the private L1D and L2 of
+// the thread and, on a miss, through the shared LLC whose sets are
+// guarded by striped locks. Caches are inclusive of nothing, each level
+// just sees the misses of the one above. References are attributed to
+// the routine that issued them through the proccount routine ids.
+
+static const char* CacheLevelNames[CACHESIM_LEVELS] = { "L1D", "L2", "LLC" };
+
+static UINT32 LineShift = 6;
+static UINT32 Policy = CACHESIM_POLICY_LRU;
+static cache_level_t L1;            // geometry of the private caches
+static cache_level_t L2;
+static cache_level_t Llc;
+static PIN_LOCK LlcLocks[CACHESIM_LLC_LOCKS];
+static BUFFER_ID RefBuffer;
+
+static cachesim_thread_t* get_cachesim(THREADID threadid)
+{
+    return static_cast<cachesim_thread_t*>(get_tls(threadid)->_tool);
+}
+
+static UINT32 Cache_Log2(UINT32 value)
+{
+    UINT32 bits = 0;
+    while ( (1U << (bits + 1)) <= value )
+        bits++;
+    return bits;
+}
+
+// Geometry from size and associativity, sets and ways are rounded down to
+// powers of two so that a set is picked with a mask
+static VOID Cache_Create(cache_level_t *cache, const char *name, UINT32 size, UINT32 assoc)
+{
+    assoc = 1U << Cache_Log2(std::max(std::min(assoc, 32U), 1U));
+    UINT32 sets = std::max(size >> LineShift, 1U) / assoc;
+    sets = 1U << Cache_Log2(std::max(sets, 1U));
+    if ( (sets * assoc) << LineShift != size )
+        WARN(name << " rounded to " << ((sets * assoc) << LineShift) << " bytes, " << assoc << " ways");
+
+    cache->_sets = sets;
+    cache->_setMask = sets - 1;
+    cache->_assoc = assoc;
+    cache->_policy = Policy;
+    cache->_lines = new ADDRINT[sets * assoc];
+    memset(cache->_lines, 0xff, sets * assoc * sizeof(ADDRINT));
+    cache->_plru = new UINT32[sets]();
+}
+
+// Empty cache with the geometry of another one
+static VOID Cache_Copy(cache_level_t *cache, const cache_level_t *from)
+{
+    *cache = *from;
+    cache->_lines = new ADDRINT[cache->_sets * cache->_assoc];
+    memset(cache->_lines, 0xff, cache->_sets * cache->_assoc * sizeof(ADDRINT));
+    cache->_plru = new UINT32[cache->_sets]();
+}
+
+// Point the PLRU tree of a set away from a way
+static inline VOID Cache_Touch(UINT32 *bits, UINT32 assoc, UINT32 way)
+{
+    UINT32 node = 1;
+    for (UINT32 half = assoc >> 1; half; half >>= 1)
+    {
+        UINT32 right = (way & half) != 0;
+        *bits = right ? (*bits & ~(1U << node)) : (*bits | (1U << node));
+        node = 2 * node + right;
+    }
+}
+
+// Way the PLRU tree points at
+static inline UINT32 Cache_Victim(UINT32 bits, UINT32 assoc)
+{
+    UINT32 node = 1;
+    UINT32 way = 0;
+    for (UINT32 half = assoc >> 1; half; half >>= 1)
+    {
+        UINT32 right = (bits >> node) & 1;
+        way |= right ? half : 0;
+        node = 2 * node + right;
+    }
+    return way;
+}
+
+// Look up a line and fill it on a miss, returns TRUE on a hit
+static inline BOOL Cache_Access(cache_level_t *cache, ADDRINT line)
+{
+    UINT32 set = line & cache->_setMask;
+    ADDRINT *ways = &cache->_lines[set * cache->_assoc];
+
+    if ( cache->_policy == CACHESIM_POLICY_LRU )
+    {
+        // Most recently used first, a hit moves the line to the front
+        if ( ways[0] == line )
+            return TRUE;
+        UINT32 way = 1;
+        while ( way < cache->_assoc && ways[way] != line )
+            way++;
+        BOOL hit = way < cache->_assoc;
+        if ( !hit )
+            way = cache->_assoc - 1;
+        memmove(ways + 1, ways, way * sizeof(ADDRINT));
+        ways[0] = line;
+        return hit;
+    }
+
+    for (UINT32 way = 0; way < cache->_assoc; way++)
+    {
+        if ( ways[way] == line )
+        {
+            Cache_Touch(&cache->_plru[set], cache->_assoc, way);
+            return TRUE;
+        }
+    }
+    UINT32 victim = Cache_Victim(cache->_plru[set], cache->_assoc);
+    ways[victim] = line;
+    Cache_Touch(&cache->_plru[set], cache->_assoc, victim);
+    return FALSE;
+}
+
+VOID Cachesim_Init()
+{
+    LineShift = Cache_Log2(std::max(KnobCacheLine.Value(), 1U));
+    Policy = KnobCachePolicy.Value() == "plru" ? CACHESIM_POLICY_PLRU : CACHESIM_POLICY_LRU;
+
+    Cache_Create(&L1, "L1D", KnobCacheL1Size.Value(), KnobCacheL1Assoc.Value());
+    Cache_Create(&L2, "L2", KnobCacheL2Size.Value(), KnobCacheL2Assoc.Value());
+    Cache_Create(&Llc, "LLC", KnobCacheLlcSize.Value(), KnobCacheLlcAssoc.Value());
+    for (UINT32 i = 0; i < CACHESIM_LLC_LOCKS; i++)
+        InitLock(&LlcLocks[i]);
+
+    RefBuffer = PIN_DefineTraceBuffer(sizeof(cachesim_ref_t), CACHESIM_BUFFER_PAGES, Cachesim_BufferFull, 0);
+    if ( RefBuffer == BUFFER_ID_INVALID )
+        ERROR("Failed to define the cachesim reference buffer");
+}
+
+VOID Cachesim_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    cachesim_thread_t* ct = new cachesim_thread_t();
+    Cache_Copy(&ct->_l1, &L1);
+    Cache_Copy(&ct->_l2, &L2);
+    get_tls(threadid)->_tool = ct;
+}
+
+// One line through the hierarchy
+static inline VOID Cachesim_Access(cachesim_thread_t* ct, ADDRINT line, UINT32 rtn, THREADID threadid)
+{
+    UINT32 level = CACHESIM_L1;
+    if ( !Cache_Access(&ct->_l1, line) )
+    {
+        level = CACHESIM_L2;
+        if ( !Cache_Access(&ct->_l2, line) )
+        {
+            PIN_LOCK *lock = &LlcLocks[line & Llc._setMask & (CACHESIM_LLC_LOCKS - 1)];
+            GetLock(lock, threadid+1);
+            level = Cache_Access(&Llc, line) ? CACHESIM_LLC : CACHESIM_LEVELS;
+            ReleaseLock(lock);
+        }
+    }
+
+    // All levels above the one that hit missed
+    for (UINT32 l = 0; l < CACHESIM_LEVELS && l <= level; l++)
+        ct->_accesses[l]++;
+    for (UINT32 l = 0; l < level; l++)
+        ct->_misses[l]++;
+
+    if ( rtn == CACHESIM_NO_RTN )
+        return;
+    ct->_rtnAccesses[rtn]++;
+    for (UINT32 l = 0; l < level; l++)
+        ct->_rtnMisses[l][rtn]++;
+}
+
+VOID* Cachesim_BufferFull(BUFFER_ID id, THREADID threadid, const CONTEXT *ctxt, VOID *buf, UINT64 numElements, VOID *v)
+{
+    cachesim_thread_t* ct = get_cachesim(threadid);
+    const cachesim_ref_t *refs = static_cast<const cachesim_ref_t*>(buf);
+
+    for (UINT64 i = 0; i < numElements; i++)
+    {
+        // Unaligned references may touch two lines
+        ADDRINT first = refs[i]._address >> LineShift;
+        ADDRINT last = (refs[i]._address + std::max(refs[i]._size, 1U) - 1) >> LineShift;
+        for (ADDRINT line = first; line <= last; line++)
+            Cachesim_Access(ct, line, refs[i]._rtn, threadid);
+    }
+    return buf;
+}
+
+VOID Cachesim_Trace(TRACE trace, VOID *v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if ( !Filter_Bbl(bbl) )
+            continue;
+
+        RTN rtn = RTN_FindByAddress(BBL_Address(bbl));
+        UINT32 id = RTN_Valid(rtn) ? Proccount_RtnId(rtn) : CACHESIM_NO_RTN;
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            if ( INS_IsPrefetch(ins) )
+                continue;
+
+            for (UINT32 op = 0; op < INS_MemoryOperandCount(ins); op++)
+            {
+                INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, RefBuffer,
+                                               IARG_MEMORYOP_EA, op, offsetof(cachesim_ref_t, _address),
+                                               IARG_UINT32, INS_MemoryOperandSize(ins, op), offsetof(cachesim_ref_t, _size),
+                                               IARG_UINT32, id, offsetof(cachesim_ref_t, _rtn),
+                                               IARG_END);
+            }
+        }
+    }
+}
+
+static bool Cachesim_CompareRtns(const std::pair<UINT64, UINT32> &a, const std::pair<UINT64, UINT32> &b)
+{
+    return a.first > b.first;
+}
+
+static VOID Cachesim_Rates(const UINT64 *accesses, const UINT64 *misses)
+{
+    for (UINT32 l = 0; l < CACHESIM_LEVELS; l++)
+        OutFile << "," << accesses[l] << "," << misses[l] << ","
+                << (accesses[l] ? (double)misses[l] / accesses[l] : 0.0);
+}
+
+VOID Cachesim_Fini(INT32 code, VOID *v)
+{
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    OutFile << "# Line " << (1U << LineShift) << " bytes, " << (Policy == CACHESIM_POLICY_PLRU ? "PLRU" : "LRU");
+    OutFile << ", L1D " << L1._sets << "x" << L1._assoc;
+    OutFile << ", L2 " << L2._sets << "x" << L2._assoc;
+    OutFile << ", LLC " << Llc._sets << "x" << Llc._assoc << endl;
+
+    OutFile << "Thread";
+    for (UINT32 l = 0; l < CACHESIM_LEVELS; l++)
+        OutFile << "," << CacheLevelNames[l] << "Accesses," << CacheLevelNames[l] << "Misses," << CacheLevelNames[l] << "MissRate";
+    OutFile << endl;
+
+    UINT64 accesses[CACHESIM_LEVELS] = { 0 };
+    UINT64 misses[CACHESIM_LEVELS] = { 0 };
+    for (INT32 t = 0; t < numThreads; t++)
+    {
+        cachesim_thread_t* ct = get_cachesim(t);
+        OutFile << t;
+        Cachesim_Rates(ct->_accesses, ct->_misses);
+        OutFile << endl;
+        for (UINT32 l = 0; l < CACHESIM_LEVELS; l++)
+        {
+            accesses[l] += ct->_accesses[l];
+            misses[l] += ct->_misses[l];
+        }
+    }
+    OutFile << "total";
+    Cachesim_Rates(accesses, misses);
+    OutFile << endl;
+
+    // Top routines by LLC misses
+    std::vector< std::pair<UINT64, UINT32> > hot;
+    std::vector< std::vector<UINT64> > rtnAccesses(RtnTable.size(), std::vector<UINT64>(CACHESIM_LEVELS, 0));
+    std::vector< std::vector<UINT64> > rtnMisses(RtnTable.size(), std::vector<UINT64>(CACHESIM_LEVELS, 0));
+    for (UINT32 id = 0; id < RtnTable.size(); id++)
+    {
+        for (INT32 t = 0; t < numThreads; t++)
+        {
+            cachesim_thread_t* ct = get_cachesim(t);
+            UINT64 reached = ct->_rtnAccesses.get(id);
+            for (UINT32 l = 0; l < CACHESIM_LEVELS; l++)
+            {
+                rtnAccesses[id][l] += reached;
+                reached = ct->_rtnMisses[l].get(id);
+                rtnMisses[id][l] += reached;
+            }
+        }
+        if ( rtnAccesses[id][CACHESIM_L1] )
+            hot.push_back(std::make_pair(rtnMisses[id][CACHESIM_LLC], id));
+    }
+    UINT32 topN = std::min((size_t)KnobTopN.Value(), hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + topN, hot.end(), Cachesim_CompareRtns);
+
+    OutFile << endl << "Rank,Procedure,Image";
+    for (UINT32 l = 0; l < CACHESIM_LEVELS; l++)
+        OutFile << "," << CacheLevelNames[l] << "Accesses," << CacheLevelNames[l] << "Misses," << CacheLevelNames[l] << "MissRate";
+    OutFile << endl;
+    for (UINT32 i = 0; i < topN; i++)
+    {
+        UINT32 id = hot[i].second;
+        OutFile << i+1 << ",\"" << RtnTable[id]->_name << "\"," << RtnTable[id]->_image;
+        Cachesim_Rates(&rtnAccesses[id][0], &rtnMisses[id][0]);
+        OutFile << endl;
+    }
+
+    Filter_Report(OutFile);
+    OutFile.close();
+    ReleaseLock(&OutFileLock);
+}
@@ -0,0 +1,106 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_CACHESIM_H
+#define MEMPIN_CACHESIM_H
+
+//
+// Tool entry points
+//
+
+BOOL cachesim(INT32 toolId);
+
+// Cache levels, L1D and L2 are private to a thread, the LLC is shared
+#define CACHESIM_L1 0
+#define CACHESIM_L2 1
+#define CACHESIM_LLC 2
+#define CACHESIM_LEVELS 3
+
+#define CACHESIM_POLICY_LRU 0
+#define CACHESIM_POLICY_PLRU 1
+
+// The LLC sets are guarded by this many locks
+#define CACHESIM_LLC_LOCKS 256
+
+// Pages of each per-thread reference buffer
+#define CACHESIM_BUFFER_PAGES 64
+
+// Routine id of references outside of any known routine
+#define CACHESIM_NO_RTN 0xffffffff
+
+// Set associative cache. Each set holds the line numbers of its ways,
+// ordered from most to least recently used for LRU. PLRU keeps the ways in
+// place and one tree of direction bits per set.
+typedef struct CacheLevel
+{
+    UINT32 _sets;
+    UINT32 _setMask;
+    UINT32 _assoc;
+    UINT32 _policy;
+    ADDRINT * _lines;           // _sets * _assoc, ~0 marks an empty way
+    UINT32 * _plru;
+} cache_level_t;
+
+// Memory reference as recorded in the trace buffer
+typedef struct CachesimRef
+{
+    ADDRINT _address;
+    UINT32 _size;
+    UINT32 _rtn;                // proccount routine id
+} cachesim_ref_t;
+
+// Per-thread state, kept in thread_data_t::_tool
+typedef struct CachesimThread
+{
+    cache_level_t _l1;
+    cache_level_t _l2;
+    UINT64 _accesses[CACHESIM_LEVELS];
+    UINT64 _misses[CACHESIM_LEVELS];
+    counter_table_t _rtnAccesses;
+    counter_table_t _rtnMisses[CACHESIM_LEVELS];
+} cachesim_thread_t;
+
+/** Sets up the shared LLC and the reference buffer */
+VOID Cachesim_Init();
+
+/** Thread start callback, sets up the private caches */
+VOID Cachesim_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
+
+/** Runs a full reference buffer through the caches */
+VOID* Cachesim_BufferFull(BUFFER_ID id, THREADID threadid, const CONTEXT *ctxt, VOID *buf, UINT64 numElements, VOID *v);
+
+/** Trace instrumentation, records all memory operands */
+VOID Cachesim_Trace(TRACE trace, VOID *v);
+
+/** Finish callback */
+VOID Cachesim_Fini(INT32 code, VOID *v);
+
+#endif // MEMPIN_CACHESIM_H
@@ -0,0 +1,283 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_callgraph.h"
+
+//
+// Tool Registration
+//
+
+BOOL callgraph(INT32 toolId)
+{
+    if ( toolId == TOOL_CALLGRAPH )
+    {
+        LOGI("Registering callbacks for callgraph");
+
+        // Per-thread counters of inscount
+        Inscount_Init();
+
+        // Shadow stack of each thread, after Inscount_ThreadStart
+        PIN_AddThreadStartFunction(Callgraph_ThreadStart, 0);
+
+        // Routine entries and returns
+        RTN_AddInstrumentFunction(Callgraph_Instruction, 0);
+        TRACE_AddInstrumentFunction(Callgraph_Trace, 0);
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(Callgraph_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// Callgraph implementation
+//
+// Each thread keeps a shadow call stack of the routines entered. Frames are
+// matched by stack pointer rather than by pairing calls with returns: on
+// entry and on return all frames at or below the current stack pointer are
+// dead. A tail call enters the callee with the stack pointer of the caller
+// and replaces its frame, a longjmp unwinds all frames it skipped on the
+// next entry or return.
+//
+// Instructions are charged to the calling context tree node on top of the
+// stack (exclusive cost), inclusive costs are taken from the instruction
+// counter when a frame gets popped. Routines use the ids of proccount.
+
+static callgraph_thread_t* get_callgraph(THREADID threadid)
+{
+    return static_cast<callgraph_thread_t*>(get_tls(threadid)->_tool);
+}
+
+VOID Callgraph_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    callgraph_thread_t* ct = new callgraph_thread_t;
+    ct->_root._rtn = 0;
+    ct->_root._parent = 0;
+    ct->_root._calls = 0;
+    ct->_root._self = 0;
+    ct->_current = &ct->_root;
+    ct->_icount = 0;
+
+    get_tls(threadid)->_tool = ct;
+}
+
+// Pop all frames that are dead for the given stack pointer
+static VOID Callgraph_Unwind(callgraph_thread_t* ct, ADDRINT sp)
+{
+    while ( !ct->_stack.empty() && ct->_stack.back()._sp <= sp )
+    {
+        callgraph_frame_t &frame = ct->_stack.back();
+        UINT32 rtn = frame._node->_rtn;
+
+        // Recursive calls are already part of the outermost frame
+        if ( --ct->_active[rtn] == 0 )
+            ct->_inclusive[rtn] += ct->_icount - frame._start;
+
+        ct->_stack.pop_back();
+    }
+    ct->_current = ct->_stack.empty() ? &ct->_root : ct->_stack.back()._node;
+}
+
+// Routine entry, sp points to the return address
+VOID Callgraph_Enter(UINT32 id, ADDRINT sp, THREADID threadid)
+{
+    callgraph_thread_t* ct = get_callgraph(threadid);
+    Callgraph_Unwind(ct, sp);
+
+    callgraph_node_t *parent = ct->_current;
+    callgraph_node_t *&node = parent->_children[id];
+    if ( !node )
+    {
+        node = new callgraph_node_t;
+        node->_rtn = id;
+        node->_parent = parent;
+        node->_calls = 0;
+        node->_self = 0;
+    }
+    node->_calls++;
+    ct->_active[id]++;
+
+    callgraph_frame_t frame;
+    frame._sp = sp;
+    frame._node = node;
+    frame._start = ct->_icount;
+    ct->_stack.push_back(frame);
+    ct->_current = node;
+}
+
+// Return, sp points to the return address of the frame being left
+VOID Callgraph_Return(ADDRINT sp, THREADID threadid)
+{
+    Callgraph_Unwind(get_callgraph(threadid), sp);
+}
+
+// Charge the instructions of a BBL to the current context
+VOID PIN_FAST_ANALYSIS_CALL callgraph_docount(UINT32 c, THREADID threadid)
+{
+    callgraph_thread_t* ct = get_callgraph(threadid);
+    ct->_current->_self += c;
+    ct->_icount += c;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL callgraph_docount_reg(UINT32 c, thread_data_t* tdata)
+{
+    callgraph_thread_t* ct = static_cast<callgraph_thread_t*>(tdata->_tool);
+    ct->_current->_self += c;
+    ct->_icount += c;
+}
+
+VOID Callgraph_Instruction(RTN rtn, VOID *v)
+{
+    // Filtered routines do not show up on the stack
+    if ( !Filter_Rtn(rtn) )
+        return;
+
+    UINT32 id = Proccount_RtnId(rtn);
+
+    RTN_Open(rtn);
+    RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)Callgraph_Enter,
+                   IARG_UINT32, id, IARG_REG_VALUE, REG_STACK_PTR, IARG_THREAD_ID, IARG_END);
+    RTN_Close(rtn);
+}
+
+VOID Callgraph_Trace(TRACE trace, VOID *v)
+{
+    REG reg = Inscount_ToolReg();
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if ( !Filter_Bbl(bbl) )
+            continue;
+
+        if ( REG_valid(reg) )
+            BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)callgraph_docount_reg, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, BBL_NumIns(bbl), IARG_REG_VALUE, reg, IARG_END);
+        else
+            BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)callgraph_docount, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, BBL_NumIns(bbl), IARG_THREAD_ID, IARG_END);
+
+        // A BBL ends with at most one return
+        INS tail = BBL_InsTail(bbl);
+        if ( INS_IsRet(tail) )
+            INS_InsertCall(tail, IPOINT_BEFORE, (AFUNPTR)Callgraph_Return,
+                           IARG_REG_VALUE, REG_STACK_PTR, IARG_THREAD_ID, IARG_END);
+    }
+}
+
+// Routine name usable in a folded stack
+static string Callgraph_FrameName(UINT32 id)
+{
+    string name = RtnTable[id]->_name;
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        if ( name[i] == ';' || name[i] == ' ' )
+            name[i] = '_';
+    }
+    return name;
+}
+
+// Collect the folded stacks, the edges and the exclusive costs of a subtree
+static VOID Callgraph_Collect(callgraph_node_t *node, const string &path,
+                              std::map<string, UINT64> &folded,
+                              std::map<std::pair<INT32, UINT32>, UINT64> &edges,
+                              std::map<UINT32, UINT64> &exclusive)
+{
+    for (std::map<UINT32, callgraph_node_t *>::iterator it = node->_children.begin(); it != node->_children.end(); ++it)
+    {
+        callgraph_node_t *child = it->second;
+        string childPath = path.empty() ? Callgraph_FrameName(child->_rtn) : path + ";" + Callgraph_FrameName(child->_rtn);
+
+        // The root has no routine, -1 stands for it
+        INT32 caller = node->_parent ? (INT32)node->_rtn : -1;
+        edges[std::make_pair(caller, child->_rtn)] += child->_calls;
+        exclusive[child->_rtn] += child->_self;
+        if ( child->_self )
+            folded[childPath] += child->_self;
+
+        Callgraph_Collect(child, childPath, folded, edges, exclusive);
+    }
+}
+
+// This function is called when the application exits. The folded stacks go
+// to the output file, the routine and edge costs next to it.
+VOID Callgraph_Fini(INT32 code, VOID *v)
+{
+    std::map<string, UINT64> folded;
+    std::map<std::pair<INT32, UINT32>, UINT64> edges;
+    std::map<UINT32, UINT64> exclusive;
+    std::map<UINT32, UINT64> inclusive;
+
+    for (INT32 t=0; t<numThreads; t++)
+    {
+        callgraph_thread_t* ct = get_callgraph(t);
+
+        // Frames still on the stack count up to the end of the thread
+        Callgraph_Unwind(ct, ~(ADDRINT)0);
+
+        if ( ct->_root._self )
+            folded["[unknown]"] += ct->_root._self;
+        Callgraph_Collect(&ct->_root, "", folded, edges, exclusive);
+
+        for (UINT32 id = 0; id < RtnTable.size(); id++)
+        {
+            UINT64 cost = ct->_inclusive.get(id);
+            if ( cost )
+                inclusive[id] += cost;
+        }
+    }
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    // Folded stacks, one line per call path, as read by flamegraph.pl
+    for (std::map<string, UINT64>::iterator it = folded.begin(); it != folded.end(); ++it)
+        OutFile << it->first << " " << it->second << endl;
+    OutFile.close();
+
+    // Routine costs and call edges
+    ofstream edgeFile((OutFileName + ".callgraph.csv").c_str());
+    edgeFile << "Procedure,Image,Inclusive,Exclusive" << endl;
+    for (std::map<UINT32, UINT64>::iterator it = inclusive.begin(); it != inclusive.end(); ++it)
+    {
+        RTN_COUNT *rc = RtnTable[it->first];
+        edgeFile << "\"" << rc->_name << "\"," << rc->_image << "," << it->second << "," << exclusive[it->first] << endl;
+    }
+
+    edgeFile << endl << "Caller,Callee,Calls" << endl;
+    for (std::map<std::pair<INT32, UINT32>, UINT64>::iterator it = edges.begin(); it != edges.end(); ++it)
+    {
+        string caller = it->first.first < 0 ? "[root]" : RtnTable[it->first.first]->_name;
+        edgeFile << "\"" << caller << "\",\"" << RtnTable[it->first.second]->_name << "\"," << it->second << endl;
+    }
+    Filter_Report(edgeFile);
+    edgeFile.close();
+    ReleaseLock(&OutFileLock);
+}
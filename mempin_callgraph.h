@@ -0,0 +1,82 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_CALLGRAPH_H
+#define MEMPIN_CALLGRAPH_H
+
+//
+// Tool entry points
+//
+
+BOOL callgraph(INT32 toolId);
+
+// Calling context tree node, one per distinct call path of a thread
+typedef struct CallgraphNode
+{
+    UINT32 _rtn;
+    struct CallgraphNode * _parent;
+    std::map<UINT32, struct CallgraphNode *> _children;
+    UINT64 _calls;
+    UINT64 _self;
+} callgraph_node_t;
+
+// Shadow stack frame
+typedef struct CallgraphFrame
+{
+    ADDRINT _sp;                // stack pointer on routine entry
+    callgraph_node_t * _node;
+    UINT64 _start;              // instruction count on routine entry
+} callgraph_frame_t;
+
+// Per-thread call graph state, kept in thread_data_t::_tool
+typedef struct CallgraphThread
+{
+    std::vector<callgraph_frame_t> _stack;
+    callgraph_node_t _root;
+    callgraph_node_t * _current;
+    UINT64 _icount;
+    chunked_table_t<UINT32> _active;    // frames of each routine on the stack
+    counter_table_t _inclusive;         // inclusive instructions of each routine
+} callgraph_thread_t;
+
+/** Thread start callback, sets up the shadow stack */
+VOID Callgraph_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
+
+/** Routine instrumentation, tracks routine entries */
+VOID Callgraph_Instruction(RTN rtn, VOID *v);
+
+/** Trace instrumentation, tracks returns and instruction counts */
+VOID Callgraph_Trace(TRACE trace, VOID *v);
+
+/** Finish callback */
+VOID Callgraph_Fini(INT32 code, VOID *v);
+
+#endif // MEMPIN_CALLGRAPH_H
@@ -0,0 +1,90 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_COUNTERS_H
+#define MEMPIN_COUNTERS_H
+
+//
+// Per-thread table indexed by a dense id that is handed out at
+// instrumentation time (one per BBL, routine, instruction...). The storage
+// is allocated in chunks on first use, so the table never has to be resized
+// while other code holds on to it and the owning thread never needs a lock.
+// Other threads may read it once the owner is done (Fini).
+//
+
+#define COUNTER_CHUNK_BITS 12
+#define COUNTER_CHUNK_SIZE (1 << COUNTER_CHUNK_BITS)
+#define COUNTER_MAX_CHUNKS 8192
+#define COUNTER_MAX_ID (COUNTER_CHUNK_SIZE * COUNTER_MAX_CHUNKS)
+
+template <typename T>
+class chunked_table_t
+{
+  public:
+    chunked_table_t() : _chunks(0) {}
+
+    /** Entry of the given id, allocated (zeroed) on first access */
+    T& operator[](UINT32 id)
+    {
+        if ( !_chunks )
+            _chunks = new T*[COUNTER_MAX_CHUNKS]();
+
+        T*& chunk = _chunks[id >> COUNTER_CHUNK_BITS];
+        if ( !chunk )
+            chunk = new T[COUNTER_CHUNK_SIZE]();
+        return chunk[id & (COUNTER_CHUNK_SIZE - 1)];
+    }
+
+    /** Entry of the given id or 0 if it has never been touched */
+    const T* find(UINT32 id) const
+    {
+        if ( !_chunks || !_chunks[id >> COUNTER_CHUNK_BITS] )
+            return 0;
+        return &_chunks[id >> COUNTER_CHUNK_BITS][id & (COUNTER_CHUNK_SIZE - 1)];
+    }
+
+  private:
+    T** _chunks;
+};
+
+// Plain event counters
+class counter_table_t : public chunked_table_t<UINT64>
+{
+  public:
+    /** Value of the counter, 0 if never touched */
+    UINT64 get(UINT32 id) const
+    {
+        const UINT64 *c = find(id);
+        return c ? *c : 0;
+    }
+};
+
+#endif // MEMPIN_COUNTERS_H
@@ -0,0 +1,430 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_falseshare.h"
+
+//
+// Tool Registration
+//
+
+BOOL falseshare(INT32 toolId)
+{
+    if ( toolId == TOOL_FALSESHARE )
+    {
+        LOGI("Registering callbacks for falseshare");
+
+        Falseshare_Init();
+
+        // Heap blocks from malloctrace, without writing the trace
+        MallocTrace_Register(FALSE, FALSE, Falseshare_Alloc, Falseshare_Free);
+        IMG_AddInstrumentFunction(Falseshare_ImageLoad, 0);
+        IMG_AddUnloadFunction(Falseshare_ImageUnload, 0);
+
+        TRACE_AddInstrumentFunction(Falseshare_Trace, 0);
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(Falseshare_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// False sharing implementation
+//
+// Each cache line remembers the thread that wrote it last and which bytes
+// it wrote. When another thread writes the line, or reads it for the first
+// time since that write, the line moves between caches. If the bytes of
+// both sides overlap the threads really share data (true sharing),
+// otherwise they only share the line (false sharing) and padding or
+// moving the fields apart fixes it. A write by the owner while other
+// threads hold a copy is compared against the bytes they read.
+//
+// Stack accesses are left out, threads rarely share their stacks. The
+// first transfer of a line looks up the heap block, or the image section
+// and global symbol, it belongs to.
+//
+// Every free and image unload bumps the epoch of the owner index. A line
+// whose owner was looked up in an older epoch checks it again on its next
+// transfer. If the memory changed hands the line so far is retired into
+// its own report row and starts over for the new owner.
+
+static falseshare_shard_t Shards[FALSESHARE_SHARDS];
+
+// Heap blocks and image sections by start address, data symbols apart
+static std::map<ADDRINT, falseshare_owner_t> Owners;
+static std::map<ADDRINT, falseshare_symbol_t> Symbols;
+static UINT64 Generation = 0;
+static volatile UINT32 OwnerEpoch = 0;
+static PIN_LOCK OwnerLock;
+
+// Lines whose memory got a new owner, with the counts of the old one
+static std::vector< std::pair<ADDRINT, falseshare_line_t> > Retired;
+static PIN_LOCK RetiredLock;
+
+VOID Falseshare_Init()
+{
+    for (UINT32 i = 0; i < FALSESHARE_SHARDS; i++)
+        InitLock(&Shards[i]._lock);
+    InitLock(&OwnerLock);
+    InitLock(&RetiredLock);
+}
+
+VOID Falseshare_Alloc(THREADID threadid, ADDRINT address, ADDRINT size, UINT32 site)
+{
+    falseshare_owner_t owner;
+    owner._end = address + size;
+    owner._site = site;
+
+    GetLock(&OwnerLock, threadid+1);
+    owner._generation = ++Generation;
+    Owners[address] = owner;
+    ReleaseLock(&OwnerLock);
+}
+
+VOID Falseshare_Free(THREADID threadid, ADDRINT address)
+{
+    GetLock(&OwnerLock, threadid+1);
+    if ( Owners.erase(address) )
+        OwnerEpoch++;
+    ReleaseLock(&OwnerLock);
+}
+
+VOID Falseshare_ImageLoad(IMG img, VOID *v)
+{
+    string image = StripPath(IMG_Name(img).c_str());
+    std::vector<SEC> data;
+
+    GetLock(&OwnerLock, BASE_LOCK_TAG);
+    for (SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec))
+    {
+        if ( !SEC_Mapped(sec) || !SEC_Size(sec) )
+            continue;
+
+        falseshare_owner_t owner;
+        owner._end = SEC_Address(sec) + SEC_Size(sec);
+        owner._site = -1;
+        owner._section = image + ":" + SEC_Name(sec);
+        owner._generation = ++Generation;
+        Owners[SEC_Address(sec)] = owner;
+        if ( !SEC_IsExecutable(sec) )
+            data.push_back(sec);
+    }
+
+    // Symbols in data sections, each reaching up to the next one
+    std::map<ADDRINT, string> symbols;
+    for (SYM sym = IMG_RegsymHead(img); SYM_Valid(sym); sym = SYM_Next(sym))
+        symbols[SYM_Address(sym)] = PIN_UndecorateSymbolName(SYM_Name(sym), UNDECORATION_NAME_ONLY);
+
+    for (std::map<ADDRINT, string>::iterator it = symbols.begin(); it != symbols.end(); ++it)
+    {
+        for (UINT32 s = 0; s < data.size(); s++)
+        {
+            ADDRINT end = SEC_Address(data[s]) + SEC_Size(data[s]);
+            if ( it->first < SEC_Address(data[s]) || it->first >= end )
+                continue;
+
+            std::map<ADDRINT, string>::iterator next = it;
+            if ( ++next != symbols.end() )
+                end = std::min(end, next->first);
+
+            falseshare_symbol_t symbol;
+            symbol._end = end;
+            symbol._name = it->second;
+            Symbols[it->first] = symbol;
+            break;
+        }
+    }
+    ReleaseLock(&OwnerLock);
+}
+
+VOID Falseshare_ImageUnload(IMG img, VOID *v)
+{
+    GetLock(&OwnerLock, BASE_LOCK_TAG);
+    Owners.erase(Owners.lower_bound(IMG_LowAddress(img)), Owners.upper_bound(IMG_HighAddress(img)));
+    Symbols.erase(Symbols.lower_bound(IMG_LowAddress(img)), Symbols.upper_bound(IMG_HighAddress(img)));
+    OwnerEpoch++;
+    ReleaseLock(&OwnerLock);
+}
+
+// Heap block, or section and symbol, of a contended line
+static falseshare_detail_t* Falseshare_Detail(ADDRINT address, THREADID threadid)
+{
+    falseshare_detail_t* detail = new falseshare_detail_t();
+    detail->_site = -1;
+    detail->_offset = 0;
+    detail->_generation = 0;
+
+    GetLock(&OwnerLock, threadid+1);
+    detail->_epoch = OwnerEpoch;
+    std::map<ADDRINT, falseshare_owner_t>::iterator it = Owners.upper_bound(address);
+    if ( it != Owners.begin() && (--it)->second._end > address )
+    {
+        detail->_site = it->second._site;
+        detail->_section = it->second._section;
+        detail->_offset = address - it->first;
+        detail->_generation = it->second._generation;
+    }
+
+    if ( detail->_site < 0 )
+    {
+        std::map<ADDRINT, falseshare_symbol_t>::iterator sym = Symbols.upper_bound(address);
+        if ( sym != Symbols.begin() && (--sym)->second._end > address )
+        {
+            detail->_section += ":" + sym->second._name;
+            detail->_offset = address - sym->first;
+        }
+    }
+    ReleaseLock(&OwnerLock);
+    return detail;
+}
+
+// The owner index changed since the line looked up its owner. If the
+// memory has a new owner, the line so far goes to the retired rows.
+static VOID Falseshare_Revalidate(falseshare_line_t &line, ADDRINT address, THREADID threadid)
+{
+    falseshare_detail_t *detail = Falseshare_Detail(address, threadid);
+    if ( detail->_generation == line._detail->_generation )
+    {
+        line._detail->_epoch = detail->_epoch;
+        delete detail;
+        return;
+    }
+
+    GetLock(&RetiredLock, threadid+1);
+    Retired.push_back(std::make_pair(address, line));
+    ReleaseLock(&RetiredLock);
+
+    line._falseSharing = 0;
+    line._trueSharing = 0;
+    line._threads = 1ULL << (threadid & 63);
+    line._detail = detail;
+}
+
+// Bytes [offset, offset + size) of a line
+static inline UINT64 Falseshare_Mask(UINT32 offset, UINT32 size)
+{
+    UINT64 bytes = size >= FALSESHARE_LINE ? ~0ULL : (1ULL << size) - 1;
+    return bytes << offset;
+}
+
+// Count an instruction taking part in a transfer, its source line gets
+// resolved on first sight as the image may be unloaded before Fini
+static inline VOID Falseshare_Ip(falseshare_detail_t *detail, ADDRINT ip)
+{
+    if ( detail->_ips[ip]++ == 0 )
+        SourceLocation_Record(ip);
+}
+
+// Count a transfer of the line to the accessing thread, other is the
+// instruction of the thread it comes from
+static VOID Falseshare_Transfer(falseshare_line_t &line, ADDRINT address, BOOL shared, ADDRINT ip, ADDRINT other, THREADID threadid)
+{
+    ADDRINT base = address & ~(ADDRINT)(FALSESHARE_LINE - 1);
+    if ( line._detail && line._detail->_epoch != OwnerEpoch )
+        Falseshare_Revalidate(line, base, threadid);
+    if ( !line._detail )
+        line._detail = Falseshare_Detail(base, threadid);
+
+    if ( shared )
+        line._trueSharing++;
+    else
+        line._falseSharing++;
+
+    Falseshare_Ip(line._detail, ip);
+    if ( other != ip )
+        Falseshare_Ip(line._detail, other);
+}
+
+static VOID Falseshare_Line(ADDRINT address, UINT64 mask, BOOL isWrite, ADDRINT ip, THREADID threadid)
+{
+    ADDRINT tag = address >> FALSESHARE_LINE_BITS;
+    UINT64 self = 1ULL << (threadid & 63);
+    falseshare_shard_t *shard = &Shards[tag & (FALSESHARE_SHARDS - 1)];
+
+    GetLock(&shard->_lock, threadid+1);
+    std::map<ADDRINT, falseshare_line_t>::iterator it = shard->_lines.find(tag);
+    if ( it == shard->_lines.end() )
+    {
+        falseshare_line_t fresh;
+        memset(&fresh, 0, sizeof(fresh));
+        fresh._writer = -1;
+        it = shard->_lines.insert(std::make_pair(tag, fresh)).first;
+    }
+    falseshare_line_t &line = it->second;
+    line._threads |= self;
+
+    if ( isWrite )
+    {
+        if ( line._writer >= 0 && (THREADID)line._writer != threadid )
+            Falseshare_Transfer(line, address, (line._writeMask & mask) != 0, ip, line._writerIp, threadid);
+        else if ( line._readers & ~self )
+            Falseshare_Transfer(line, address, (line._readMask & mask) != 0, ip, line._readerIp, threadid);
+
+        if ( (THREADID)line._writer != threadid )
+            line._writeMask = 0;
+        line._writer = threadid;
+        line._writerIp = ip;
+        line._writeMask |= mask;
+        line._readers = self;
+        line._readMask = 0;
+    }
+    else if ( (THREADID)line._writer != threadid )
+    {
+        if ( line._writer >= 0 && !(line._readers & self) )
+        {
+            Falseshare_Transfer(line, address, (line._writeMask & mask) != 0, ip, line._writerIp, threadid);
+            line._readers |= self;
+            line._readMask |= mask;
+        }
+        line._readerIp = ip;
+    }
+    ReleaseLock(&shard->_lock);
+}
+
+VOID falseshare_access(ADDRINT ip, ADDRINT address, UINT32 size, BOOL isWrite, THREADID threadid)
+{
+    // An access may straddle two lines
+    UINT32 offset = address & (FALSESHARE_LINE - 1);
+    UINT32 first = std::min(size, FALSESHARE_LINE - offset);
+    Falseshare_Line(address, Falseshare_Mask(offset, first), isWrite, ip, threadid);
+    if ( first < size )
+        Falseshare_Line(address + first, Falseshare_Mask(0, size - first), isWrite, ip, threadid);
+}
+
+VOID Falseshare_Trace(TRACE trace, VOID *v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if ( !Filter_Bbl(bbl) )
+            continue;
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            if ( INS_IsStackRead(ins) || INS_IsStackWrite(ins) || INS_IsPrefetch(ins) )
+                continue;
+
+            for (UINT32 op = 0; op < INS_MemoryOperandCount(ins); op++)
+            {
+                INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)falseshare_access,
+                                         IARG_INST_PTR, IARG_MEMORYOP_EA, op,
+                                         IARG_UINT32, INS_MemoryOperandSize(ins, op),
+                                         IARG_BOOL, INS_MemoryOperandIsWritten(ins, op),
+                                         IARG_THREAD_ID, IARG_END);
+            }
+        }
+    }
+}
+
+// False sharing first as that is what padding fixes
+static bool Falseshare_CompareLines(const std::pair<ADDRINT, const falseshare_line_t *> &a,
+                                    const std::pair<ADDRINT, const falseshare_line_t *> &b)
+{
+    if ( a.second->_falseSharing != b.second->_falseSharing )
+        return a.second->_falseSharing > b.second->_falseSharing;
+    return a.second->_trueSharing > b.second->_trueSharing;
+}
+
+static bool Falseshare_CompareIps(const std::pair<UINT64, ADDRINT> &a, const std::pair<UINT64, ADDRINT> &b)
+{
+    return a.first > b.first;
+}
+
+static UINT32 Falseshare_Count(UINT64 set)
+{
+    UINT32 count = 0;
+    for (; set; set &= set - 1)
+        count++;
+    return count;
+}
+
+VOID Falseshare_Fini(INT32 code, VOID *v)
+{
+    // Lines that moved between threads
+    std::vector< std::pair<ADDRINT, const falseshare_line_t *> > hot;
+    UINT64 falseSharing = 0;
+    UINT64 trueSharing = 0;
+    for (UINT32 i = 0; i < FALSESHARE_SHARDS; i++)
+    {
+        std::map<ADDRINT, falseshare_line_t> &lines = Shards[i]._lines;
+        for (std::map<ADDRINT, falseshare_line_t>::iterator it = lines.begin(); it != lines.end(); ++it)
+        {
+            falseSharing += it->second._falseSharing;
+            trueSharing += it->second._trueSharing;
+            if ( it->second._detail )
+                hot.push_back(std::make_pair(it->first << FALSESHARE_LINE_BITS, &it->second));
+        }
+    }
+    for (UINT32 i = 0; i < Retired.size(); i++)
+    {
+        falseSharing += Retired[i].second._falseSharing;
+        trueSharing += Retired[i].second._trueSharing;
+        hot.push_back(std::make_pair(Retired[i].first, &Retired[i].second));
+    }
+    UINT32 topN = std::min((size_t)KnobTopN.Value(), hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + topN, hot.end(), Falseshare_CompareLines);
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    OutFile << "# Line transfers: " << falseSharing << " false sharing, " << trueSharing << " true sharing" << endl;
+    OutFile << "Rank,Line,FalseSharing,TrueSharing,Threads,Owner,Offset,Stack" << endl;
+    for (UINT32 i = 0; i < topN; i++)
+    {
+        const falseshare_line_t *line = hot[i].second;
+        const falseshare_detail_t *detail = line->_detail;
+
+        string owner = detail->_site >= 0 ? "heap " + hexstr(MallocTrace_SiteHash(detail->_site))
+                     : detail->_section.empty() ? "?" : detail->_section;
+        OutFile << i+1 << "," << hexstr(hot[i].first) << "," << line->_falseSharing << "," << line->_trueSharing << ","
+                << Falseshare_Count(line->_threads) << "," << owner << "," << detail->_offset << ","
+                << (detail->_site >= 0 ? MallocTrace_SiteStack(detail->_site) : "") << endl;
+    }
+
+    // The instructions on both ends of the transfers of those lines
+    OutFile << endl << "Rank,Line,Transfers,Ip," << SOURCE_LOCATION_HEADER << endl;
+    for (UINT32 i = 0; i < topN; i++)
+    {
+        const std::map<ADDRINT, UINT64> &ips = hot[i].second->_detail->_ips;
+        std::vector< std::pair<UINT64, ADDRINT> > top;
+        for (std::map<ADDRINT, UINT64>::const_iterator it = ips.begin(); it != ips.end(); ++it)
+            top.push_back(std::make_pair(it->second, it->first));
+        UINT32 topIps = std::min((size_t)FALSESHARE_MAX_IPS, top.size());
+        std::partial_sort(top.begin(), top.begin() + topIps, top.end(), Falseshare_CompareIps);
+
+        for (UINT32 j = 0; j < topIps; j++)
+            OutFile << i+1 << "," << hexstr(hot[i].first) << "," << top[j].first << "," << hexstr(top[j].second) << ","
+                    << SourceLocation(top[j].second) << endl;
+    }
+
+    Filter_Report(OutFile);
+    OutFile.close();
+    ReleaseLock(&OutFileLock);
+}
@@ -0,0 +1,121 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_FALSESHARE_H
+#define MEMPIN_FALSESHARE_H
+
+//
+// Tool entry points
+//
+
+BOOL falseshare(INT32 toolId);
+
+// Coherence granularity, the byte masks below hold one bit per byte
+#define FALSESHARE_LINE_BITS 6
+#define FALSESHARE_LINE (1 << FALSESHARE_LINE_BITS)
+
+// Shards of the line table, each with its own lock
+#define FALSESHARE_SHARDS 256
+
+// Instructions kept per line for the report
+#define FALSESHARE_MAX_IPS 4
+
+// Where a contended line lives and who touched it, allocated on the first
+// transfer of the line
+typedef struct FalseshareDetail
+{
+    std::map<ADDRINT, UINT64> _ips;     // transfers by instruction
+    INT32 _site;                        // malloctrace site, -1 if not on the heap
+    ADDRINT _offset;                    // of the line in its block, symbol or section
+    string _section;                    // image section and symbol if not on the heap
+    UINT64 _generation;                 // of the owner, 0 if none
+    UINT32 _epoch;                      // owner index epoch of the lookup
+} falseshare_detail_t;
+
+// Shadow state of one cache line. Threads are kept in 64 bit sets, so
+// thread ids alias modulo 64.
+typedef struct FalseshareLine
+{
+    INT32 _writer;              // last writer, -1 if never written
+    ADDRINT _writerIp;
+    UINT64 _writeMask;          // bytes written by _writer since it took the line
+    UINT64 _readers;            // threads that read the line since the last write
+    UINT64 _readMask;           // bytes those threads read
+    ADDRINT _readerIp;          // last read by another thread than _writer
+    UINT64 _threads;            // all threads that ever touched the line
+    UINT64 _falseSharing;
+    UINT64 _trueSharing;
+    falseshare_detail_t * _detail;
+} falseshare_line_t;
+
+typedef struct FalseshareShard
+{
+    PIN_LOCK _lock;
+    std::map<ADDRINT, falseshare_line_t> _lines;
+    UINT8 _pad[64];
+} falseshare_shard_t;
+
+// Heap block or image section in the owner index
+typedef struct FalseshareOwner
+{
+    ADDRINT _end;
+    INT32 _site;
+    string _section;
+    UINT64 _generation;         // tells a reused address from the old owner
+} falseshare_owner_t;
+
+// Global data symbol of an image, up to the next symbol or the section end
+typedef struct FalseshareSymbol
+{
+    ADDRINT _end;
+    string _name;
+} falseshare_symbol_t;
+
+/** Sets up the line table */
+VOID Falseshare_Init();
+
+/** Live block table hooks of malloctrace */
+VOID Falseshare_Alloc(THREADID threadid, ADDRINT address, ADDRINT size, UINT32 site);
+VOID Falseshare_Free(THREADID threadid, ADDRINT address);
+
+/** Image load callback, records the sections and data symbols of the image */
+VOID Falseshare_ImageLoad(IMG img, VOID *v);
+
+/** Image unload callback, drops them again */
+VOID Falseshare_ImageUnload(IMG img, VOID *v);
+
+/** Trace instrumentation, hooks all memory operands */
+VOID Falseshare_Trace(TRACE trace, VOID *v);
+
+/** Finish callback */
+VOID Falseshare_Fini(INT32 code, VOID *v);
+
+#endif // MEMPIN_FALSESHARE_H
@@ -0,0 +1,191 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_filter.h"
+
+#include <fnmatch.h>
+
+// Parsed address ranges, [first, second)
+static std::vector< std::pair<ADDRINT, ADDRINT> > FilterRanges;
+
+// Decision for each routine address, so names are matched only once
+static std::map<ADDRINT, BOOL> FilterRtnCache;
+
+static BOOL FilterEnabled = FALSE;
+static UINT64 FilterSkippedRtns = 0;
+static UINT64 FilterSkippedBbls = 0;
+
+// Number of patterns of a knob. An append knob may hold its empty default.
+static UINT32 Filter_Count(KNOB<string> &knob)
+{
+    UINT32 count = 0;
+    for (UINT32 i = 0; i < knob.NumberOfValues(); i++)
+        count += !knob.Value(i).empty();
+    return count;
+}
+
+// A library loaded later at the same addresses gets its own decisions
+static VOID Filter_ImageUnload(IMG img, VOID *v)
+{
+    FilterRtnCache.erase(FilterRtnCache.lower_bound(IMG_LowAddress(img)),
+                         FilterRtnCache.upper_bound(IMG_HighAddress(img)));
+}
+
+VOID Filter_Init()
+{
+    for (UINT32 i = 0; i < KnobFilterRange.NumberOfValues(); i++)
+    {
+        string range = KnobFilterRange.Value(i);
+        if ( range.empty() )
+            continue;
+        size_t dash = range.find('-');
+        if ( dash == string::npos )
+        {
+            ERROR("Invalid address range: " << range);
+            continue;
+        }
+        ADDRINT lo = strtoull(range.substr(0, dash).c_str(), 0, 0);
+        ADDRINT hi = strtoull(range.substr(dash + 1).c_str(), 0, 0);
+        FilterRanges.push_back(std::make_pair(lo, hi));
+    }
+
+    FilterEnabled = !FilterRanges.empty()
+        || Filter_Count(KnobFilterImgInclude) || Filter_Count(KnobFilterImgExclude)
+        || Filter_Count(KnobFilterRtnInclude) || Filter_Count(KnobFilterRtnExclude);
+
+    if ( FilterEnabled )
+    {
+        LOGI("Instrumentation filters enabled");
+        IMG_AddUnloadFunction(Filter_ImageUnload, 0);
+    }
+}
+
+BOOL Filter_Enabled()
+{
+    return FilterEnabled;
+}
+
+// TRUE if name passes an include/exclude pair of glob lists
+static BOOL Filter_Match(const string &name, KNOB<string> &include, KNOB<string> &exclude)
+{
+    BOOL included = Filter_Count(include) == 0;
+    for (UINT32 i = 0; i < include.NumberOfValues() && !included; i++)
+        included = !include.Value(i).empty() && fnmatch(include.Value(i).c_str(), name.c_str(), 0) == 0;
+    if ( !included )
+        return FALSE;
+
+    for (UINT32 i = 0; i < exclude.NumberOfValues(); i++)
+    {
+        if ( !exclude.Value(i).empty() && fnmatch(exclude.Value(i).c_str(), name.c_str(), 0) == 0 )
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static BOOL Filter_Range(ADDRINT address)
+{
+    if ( FilterRanges.empty() )
+        return TRUE;
+
+    for (size_t i = 0; i < FilterRanges.size(); i++)
+    {
+        if ( address >= FilterRanges[i].first && address < FilterRanges[i].second )
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// Image and routine name filters, cached per routine
+static BOOL Filter_Names(RTN rtn)
+{
+    ADDRINT address = RTN_Address(rtn);
+    std::map<ADDRINT, BOOL>::iterator it = FilterRtnCache.find(address);
+    if ( it != FilterRtnCache.end() )
+        return it->second;
+
+    string image = StripPath(IMG_Name(SEC_Img(RTN_Sec(rtn))).c_str());
+    BOOL pass = Filter_Match(image, KnobFilterImgInclude, KnobFilterImgExclude)
+             && Filter_Match(RTN_Name(rtn), KnobFilterRtnInclude, KnobFilterRtnExclude);
+
+    if ( !pass )
+        FilterSkippedRtns++;
+    FilterRtnCache[address] = pass;
+    return pass;
+}
+
+BOOL Filter_Rtn(RTN rtn)
+{
+    if ( !FilterEnabled )
+        return TRUE;
+
+    return Filter_Names(rtn) && Filter_Range(RTN_Address(rtn));
+}
+
+BOOL Filter_Bbl(BBL bbl)
+{
+    if ( !FilterEnabled )
+        return TRUE;
+
+    ADDRINT address = BBL_Address(bbl);
+    BOOL pass = Filter_Range(address);
+
+    if ( pass )
+    {
+        RTN rtn = RTN_FindByAddress(address);
+        if ( RTN_Valid(rtn) )
+        {
+            pass = Filter_Names(rtn);
+        }
+        else
+        {
+            // Code without symbols only passes when no routine is asked for
+            IMG img = IMG_FindByAddress(address);
+            string image = IMG_Valid(img) ? StripPath(IMG_Name(img).c_str()) : "";
+            pass = Filter_Count(KnobFilterRtnInclude) == 0
+                && Filter_Match(image, KnobFilterImgInclude, KnobFilterImgExclude);
+        }
+    }
+
+    if ( !pass )
+        FilterSkippedBbls++;
+    return pass;
+}
+
+VOID Filter_Report(ostream &out)
+{
+    if ( !FilterEnabled )
+        return;
+
+    // BBLs are counted each time they get instrumented
+    out << "# Filtered out: " << FilterSkippedRtns << " routines, "
+        << FilterSkippedBbls << " BBL instrumentations" << endl;
+}
@@ -0,0 +1,322 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_footprint.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+KNOB<UINT64> KnobFootprintInterval(KNOB_MODE_WRITEONCE, "pintool",
+    "fp_interval", "10000000", "instructions between two footprint samples.");
+
+//
+// Tool Registration
+//
+
+BOOL footprint(INT32 toolId)
+{
+    if ( toolId == TOOL_FOOTPRINT )
+    {
+        LOGI("Registering callbacks for footprint");
+
+        // Per-thread data of inscount
+        Inscount_Init();
+        PIN_AddThreadStartFunction(Footprint_ThreadStart, 0);
+
+        // Mappings and the instruction clock
+        Footprint_Init();
+        PIN_AddSyscallEntryFunction(Footprint_SyscallEntry, 0);
+        PIN_AddSyscallExitFunction(Footprint_SyscallExit, 0);
+        TRACE_AddInstrumentFunction(Footprint_Trace, 0);
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(Footprint_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// Footprint implementation
+//
+// The mapped regions of the application are rebuilt from its mmap, munmap,
+// mremap and brk calls. Memory Pin maps for itself never shows up here, nor
+// does the stack of the main thread which the kernel sets up before we run.
+//
+// Time is the number of instructions retired by all threads. Each thread
+// counts in batches and adds them to a global clock, whoever moves the
+// clock past the next sample point takes the sample. A sample equal to
+// the previous one is left out.
+
+static const char* FootprintKindNames[FOOTPRINT_NUM] = { "Heap", "Anonymous", "File", "Stack" };
+
+// Regions and samples, both under RegionLock
+static std::map<ADDRINT, footprint_region_t> Regions;
+static UINT64 Bytes[FOOTPRINT_NUM];
+static UINT64 PeakBytes[FOOTPRINT_NUM];
+static ADDRINT BrkStart = 0;
+static std::vector<footprint_sample_t> Samples;
+static PIN_LOCK RegionLock;
+
+static volatile UINT64 Clock = 0;
+static UINT64 NextSample = 0;
+static UINT64 Interval = 0;
+static UINT64 StartMs = 0;
+
+VOID Footprint_Init()
+{
+    InitLock(&RegionLock);
+    Interval = std::max(KnobFootprintInterval.Value(), (UINT64)1);
+    NextSample = Interval;
+    StartMs = GetTimeMs();
+}
+
+static footprint_thread_t* get_footprint(THREADID threadid)
+{
+    return static_cast<footprint_thread_t*>(get_tls(threadid)->_tool);
+}
+
+VOID Footprint_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    get_tls(threadid)->_tool = new footprint_thread_t();
+}
+
+static ADDRINT Footprint_PageAlign(ADDRINT size)
+{
+    return (size + 4095) & ~(ADDRINT)4095;
+}
+
+// Append a sample, called with RegionLock held
+static VOID Footprint_Sample(UINT64 instructions)
+{
+    footprint_sample_t sample;
+    sample._instructions = instructions;
+    sample._timeMs = GetTimeMs() - StartMs;
+    memcpy(sample._bytes, Bytes, sizeof(Bytes));
+
+    if ( !Samples.empty() && !memcmp(Samples.back()._bytes, sample._bytes, sizeof(Bytes)) )
+        return;
+    Samples.push_back(sample);
+}
+
+// Forget everything mapped in [start, end), called with RegionLock held
+static VOID Footprint_Unmap(ADDRINT start, ADDRINT end)
+{
+    std::map<ADDRINT, footprint_region_t>::iterator it = Regions.upper_bound(start);
+    if ( it != Regions.begin() )
+        --it;
+
+    while ( it != Regions.end() && it->first < end )
+    {
+        ADDRINT lo = it->first;
+        footprint_region_t region = it->second;
+        if ( region._end <= start )
+        {
+            ++it;
+            continue;
+        }
+
+        // Keep whatever sticks out on either side
+        Regions.erase(it++);
+        if ( lo < start )
+        {
+            footprint_region_t head = { start, region._kind };
+            Regions[lo] = head;
+        }
+        if ( region._end > end )
+        {
+            footprint_region_t tail = { region._end, region._kind };
+            it = Regions.insert(std::make_pair(end, tail)).first;
+        }
+        Bytes[region._kind] -= std::min(region._end, end) - std::max(lo, start);
+    }
+}
+
+// Add a new mapping, called with RegionLock held
+static VOID Footprint_Map(ADDRINT start, ADDRINT end, UINT32 kind)
+{
+    // MAP_FIXED replaces whatever was there
+    Footprint_Unmap(start, end);
+
+    footprint_region_t region = { end, kind };
+    Regions[start] = region;
+    Bytes[kind] += end - start;
+    PeakBytes[kind] = std::max(PeakBytes[kind], Bytes[kind]);
+}
+
+// Kind of the region holding an address, for mremap
+static UINT32 Footprint_Kind(ADDRINT address)
+{
+    std::map<ADDRINT, footprint_region_t>::iterator it = Regions.upper_bound(address);
+    if ( it == Regions.begin() || (--it)->second._end <= address )
+        return FOOTPRINT_ANON;
+    return it->second._kind;
+}
+
+VOID Footprint_SyscallEntry(THREADID threadid, CONTEXT *ctxt, SYSCALL_STANDARD std, VOID *v)
+{
+    footprint_thread_t* ft = get_footprint(threadid);
+    ft->_syscall = PIN_GetSyscallNumber(ctxt, std);
+    for (UINT32 i = 0; i < 5; i++)
+        ft->_args[i] = PIN_GetSyscallArgument(ctxt, std, i);
+}
+
+VOID Footprint_SyscallExit(THREADID threadid, CONTEXT *ctxt, SYSCALL_STANDARD std, VOID *v)
+{
+    footprint_thread_t* ft = get_footprint(threadid);
+    ADDRINT ret = PIN_GetSyscallReturn(ctxt, std);
+    ADDRINT *args = ft->_args;
+
+    // Errors come back as -errno
+    if ( ret > (ADDRINT)-4096 )
+        return;
+
+    GetLock(&RegionLock, threadid+1);
+    switch ( ft->_syscall )
+    {
+        case SYS_mmap:
+#ifdef SYS_mmap2
+        case SYS_mmap2:
+#endif
+        {
+            UINT32 kind = FOOTPRINT_FILE;
+            if ( args[3] & (MAP_STACK | MAP_GROWSDOWN) )
+                kind = FOOTPRINT_STACK;
+            else if ( args[3] & MAP_ANONYMOUS )
+                kind = FOOTPRINT_ANON;
+            Footprint_Map(ret, ret + Footprint_PageAlign(args[1]), kind);
+            break;
+        }
+        case SYS_munmap:
+            Footprint_Unmap(args[0], args[0] + Footprint_PageAlign(args[1]));
+            break;
+        case SYS_mremap:
+        {
+            UINT32 kind = Footprint_Kind(args[0]);
+            Footprint_Unmap(args[0], args[0] + Footprint_PageAlign(args[1]));
+            Footprint_Map(ret, ret + Footprint_PageAlign(args[2]), kind);
+            break;
+        }
+        case SYS_brk:
+        {
+            // The first brk is the query of the initial break by libc
+            if ( !BrkStart )
+                BrkStart = ret;
+            Bytes[FOOTPRINT_HEAP] = ret > BrkStart ? ret - BrkStart : 0;
+            PeakBytes[FOOTPRINT_HEAP] = std::max(PeakBytes[FOOTPRINT_HEAP], Bytes[FOOTPRINT_HEAP]);
+            break;
+        }
+    }
+    ReleaseLock(&RegionLock);
+}
+
+// Move the global clock, sample when it passes the next sample point
+static VOID Footprint_Tick(footprint_thread_t* ft, UINT32 c, THREADID threadid)
+{
+    ft->_pending += c;
+    if ( ft->_pending < FOOTPRINT_BATCH )
+        return;
+
+    UINT64 now = __sync_add_and_fetch(&Clock, ft->_pending);
+    ft->_pending = 0;
+    if ( now < NextSample )
+        return;
+
+    GetLock(&RegionLock, threadid+1);
+    if ( now >= NextSample )
+    {
+        Footprint_Sample(now);
+        NextSample = now - now % Interval + Interval;
+    }
+    ReleaseLock(&RegionLock);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL footprint_docount(UINT32 c, THREADID threadid)
+{
+    Footprint_Tick(get_footprint(threadid), c, threadid);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL footprint_docount_reg(UINT32 c, THREADID threadid, thread_data_t* tdata)
+{
+    Footprint_Tick(static_cast<footprint_thread_t*>(tdata->_tool), c, threadid);
+}
+
+VOID Footprint_Trace(TRACE trace, VOID *v)
+{
+    REG reg = Inscount_ToolReg();
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if ( REG_valid(reg) )
+            BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)footprint_docount_reg, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, BBL_NumIns(bbl), IARG_THREAD_ID, IARG_REG_VALUE, reg, IARG_END);
+        else
+            BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)footprint_docount, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, BBL_NumIns(bbl), IARG_THREAD_ID, IARG_END);
+    }
+}
+
+VOID Footprint_Fini(INT32 code, VOID *v)
+{
+    // Instructions still in the per-thread batches
+    UINT64 now = Clock;
+    for (INT32 t = 0; t < numThreads; t++)
+        now += get_footprint(t)->_pending;
+
+    GetLock(&RegionLock, BASE_LOCK_TAG);
+    Footprint_Sample(now);
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    OutFile << "Kind,PeakBytes,ExitBytes" << endl;
+    for (UINT32 k = 0; k < FOOTPRINT_NUM; k++)
+        OutFile << FootprintKindNames[k] << "," << PeakBytes[k] << "," << Bytes[k] << endl;
+
+    OutFile << endl << "Instructions,TimeMs";
+    for (UINT32 k = 0; k < FOOTPRINT_NUM; k++)
+        OutFile << "," << FootprintKindNames[k];
+    OutFile << ",Total" << endl;
+    for (UINT32 i = 0; i < Samples.size(); i++)
+    {
+        footprint_sample_t &s = Samples[i];
+        UINT64 total = 0;
+        OutFile << s._instructions << "," << s._timeMs;
+        for (UINT32 k = 0; k < FOOTPRINT_NUM; k++)
+        {
+            OutFile << "," << s._bytes[k];
+            total += s._bytes[k];
+        }
+        OutFile << "," << total << endl;
+    }
+    OutFile.close();
+    ReleaseLock(&OutFileLock);
+    ReleaseLock(&RegionLock);
+}
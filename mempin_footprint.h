@@ -0,0 +1,93 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_FOOTPRINT_H
+#define MEMPIN_FOOTPRINT_H
+
+//
+// Tool entry points
+//
+
+BOOL footprint(INT32 toolId);
+
+// Kinds of mapped memory
+#define FOOTPRINT_HEAP 0        // brk heap
+#define FOOTPRINT_ANON 1        // anonymous mmap
+#define FOOTPRINT_FILE 2        // file backed mmap
+#define FOOTPRINT_STACK 3       // thread stacks (MAP_STACK, MAP_GROWSDOWN)
+#define FOOTPRINT_NUM 4
+
+// Instructions a thread counts on its own before adding them to the
+// global clock
+#define FOOTPRINT_BATCH 65536
+
+// Mapped region, keyed by its start address
+typedef struct FootprintRegion
+{
+    ADDRINT _end;
+    UINT32 _kind;
+} footprint_region_t;
+
+// One point of the time series
+typedef struct FootprintSample
+{
+    UINT64 _instructions;
+    UINT64 _timeMs;
+    UINT64 _bytes[FOOTPRINT_NUM];
+} footprint_sample_t;
+
+// Per-thread state, kept in thread_data_t::_tool
+typedef struct FootprintThread
+{
+    UINT64 _pending;            // instructions not yet on the global clock
+
+    // Arguments of the syscall in flight
+    ADDRINT _syscall;
+    ADDRINT _args[5];
+} footprint_thread_t;
+
+/** Sets up the region table and the clock */
+VOID Footprint_Init();
+
+/** Thread start callback, sets up the per-thread state */
+VOID Footprint_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
+
+/** Syscall callbacks, track mmap, munmap, mremap and brk */
+VOID Footprint_SyscallEntry(THREADID threadid, CONTEXT *ctxt, SYSCALL_STANDARD std, VOID *v);
+VOID Footprint_SyscallExit(THREADID threadid, CONTEXT *ctxt, SYSCALL_STANDARD std, VOID *v);
+
+/** Trace instrumentation, drives the instruction clock */
+VOID Footprint_Trace(TRACE trace, VOID *v);
+
+/** Finish callback */
+VOID Footprint_Fini(INT32 code, VOID *v);
+
+#endif // MEMPIN_FOOTPRINT_H
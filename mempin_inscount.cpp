@@ -39,6 +39,18 @@ INT32 numThreads = 0;
 // key for accessing TLS storage in the threads. initialized once in main()
 static TLS_KEY tls_key;
 
+// Sampling state. The sampler thread switches the instrumentation on and
+// off, the trace callbacks only instrument while sample_on is set.
+static BOOL sample_enabled = FALSE;
+static volatile BOOL sample_on = TRUE;
+static volatile BOOL sample_stop = FALSE;
+static PIN_THREAD_UID sample_uid;
+static UINT64 sample_windowBegin = 0;   // ms, start of the current window
+
+// Scratch register holding the thread_data_t of the running thread. Stays
+// invalid when the TLS lookup is used instead.
+static REG tls_reg = REG_INVALID();
+
 //
 // Tool Registration
 //
@@ -49,14 +61,11 @@ BOOL inscount(INT32 toolId)
     {
     	LOGI("Registering callbacks for inscount");
 
-    	// Initialize the lock
-        InitLock(&lock);
-
-        // Obtain  a key for TLS storage.
-        tls_key = PIN_CreateThreadDataKey(0);
+        // Per-thread counters
+        Inscount_Init();
 
-    	// Callback for thread creation
-    	PIN_AddThreadStartFunction(Inscount_ThreadStart, 0);
+        // Alternate instrumented windows and uninstrumented stretches
+        Inscount_StartSampling();
 
         // Register the trace callback
 	    TRACE_AddInstrumentFunction(Inscount_Trace, 0);
@@ -74,20 +83,14 @@ BOOL inscount_ext(INT32 toolId)
     {
     	LOGI("Registering callbacks for extended inscount");
 
-    	// Initialize the lock
-        InitLock(&lock);
-
-        // Obtain  a key for TLS storage.
-        tls_key = PIN_CreateThreadDataKey(0);
+        // Per-thread counters
+        Inscount_Init();
 
-	    // Callback for thread creation
-    	PIN_AddThreadStartFunction(Inscount_ThreadStart, 0);
-
-        // Register the trace callback
-	    TRACE_AddInstrumentFunction(Inscount_Trace, 0);
+        // Alternate instrumented windows and uninstrumented stretches
+        Inscount_StartSampling();
 
-	    // Register the instruction callback
-    	INS_AddInstrumentFunction(Inscount_Ext_Instruction, 0);
+        // Register the trace callback, it also counts the instructions
+	    TRACE_AddInstrumentFunction(Inscount_Ext_Trace, 0);
 
 	    // Register Fini to be called when the application exits.
 	    PIN_AddFiniFunction(Inscount_Ext_Fini, 0);
@@ -100,6 +103,21 @@ BOOL inscount_ext(INT32 toolId)
 // Common implementation
 //
 
+VOID Inscount_Init()
+{
+    // Initialize the lock
+    InitLock(&lock);
+
+    // Obtain  a key for TLS storage.
+    tls_key = PIN_CreateThreadDataKey(0);
+
+    // Try to keep the thread data in a register
+    Inscount_ClaimToolReg();
+
+    // Callback for thread creation
+    PIN_AddThreadStartFunction(Inscount_ThreadStart, 0);
+}
+
 // function to access thread-specific data
 thread_data_t* get_tls(THREADID threadid)
 {
@@ -108,6 +126,187 @@ thread_data_t* get_tls(THREADID threadid)
     return tdata;
 }
 
+REG Inscount_ToolReg()
+{
+    return tls_reg;
+}
+
+// Claim the scratch register used to pass the thread data to the analysis
+// routines. Falls back to the TLS lookup if disabled or none is left.
+VOID Inscount_ClaimToolReg()
+{
+    if ( !KnobToolReg.Value() || REG_valid(tls_reg) )
+        return;
+
+    tls_reg = PIN_ClaimToolRegister();
+    if ( !REG_valid(tls_reg) )
+    {
+        WARN("No tool register available, using TLS lookup for thread data");
+    }
+}
+
+//
+// Sampling implementation
+//
+// Short instrumented windows alternate with long uninstrumented stretches.
+// Each switch drops the code cache so that the traces get instrumented
+// again (or not). At the end the counts of each thread are extrapolated
+// to its lifetime using the time it ran instrumented, so threads started
+// late are not scaled by the windows they missed. The spread of the
+// per-window rates gives the error bound.
+//
+// Only inscount and extended inscount sample, the tools built on top of
+// them need every execution.
+
+// Instrumented time of the thread within the current window, called with
+// the lock held
+static UINT64 Inscount_SampleOnTime(thread_data_t* tdata, UINT64 now)
+{
+    UINT64 begin = std::max(sample_windowBegin, tdata->_sampleBegin);
+    return now > begin ? now - begin : 0;
+}
+
+// Open a new window, called with the instrumentation switched off
+static VOID Inscount_SampleWindowStart()
+{
+    for (INT32 t=0; t<numThreads; t++)
+    {
+        thread_data_t* tdata = get_tls(t);
+        if (tdata)
+            tdata->_sampleStart = tdata->_count;
+    }
+    sample_windowBegin = GetTimeMs();
+    sample_on = TRUE;
+    PIN_RemoveInstrumentation();
+}
+
+// Close the current window and record the rate of each thread
+static VOID Inscount_SampleWindowEnd()
+{
+    sample_on = FALSE;
+    PIN_RemoveInstrumentation();
+
+    UINT64 now = GetTimeMs();
+    GetLock(&lock, PIN_ThreadId()+1);
+    for (INT32 t=0; t<numThreads; t++)
+    {
+        thread_data_t* tdata = get_tls(t);
+        if (!tdata || tdata->_sampleEnd)
+            continue;
+
+        UINT64 duration = Inscount_SampleOnTime(tdata, now);
+        tdata->_sampleOnTime += duration;
+        if (duration == 0)
+            continue;
+        double rate = (double)(tdata->_count - tdata->_sampleStart) / duration;
+        tdata->_rateSum += rate;
+        tdata->_rateSqSum += rate * rate;
+        tdata->_windows++;
+    }
+    ReleaseLock(&lock);
+}
+
+VOID Inscount_SampleThreadFini(THREADID threadid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+    thread_data_t* tdata = get_tls(threadid);
+    UINT64 now = GetTimeMs();
+
+    GetLock(&lock, threadid+1);
+    if ( sample_on )
+        tdata->_sampleOnTime += Inscount_SampleOnTime(tdata, now);
+    tdata->_sampleEnd = now;
+    ReleaseLock(&lock);
+}
+
+// Sleep in small steps so that we notice the end of the process
+static VOID Inscount_SampleSleep(UINT64 ms)
+{
+    UINT64 end = GetTimeMs() + ms;
+    while ( !sample_stop && GetTimeMs() < end )
+        PIN_Sleep(10);
+}
+
+// Internal thread toggling the instrumentation
+static VOID Inscount_Sampler(VOID *arg)
+{
+    UINT64 window = KnobSampleWindow.Value();
+    UINT64 stretch = window * (100 - KnobSampleDuty.Value()) / KnobSampleDuty.Value();
+
+    while ( !sample_stop )
+    {
+        Inscount_SampleSleep(window);
+        if ( sample_stop )
+            break;
+        Inscount_SampleWindowEnd();
+
+        Inscount_SampleSleep(stretch);
+        if ( sample_stop )
+            break;
+        Inscount_SampleWindowStart();
+    }
+    PIN_ExitThread(0);
+}
+
+VOID Inscount_StartSampling()
+{
+    if ( KnobSampleWindow.Value() == 0 || KnobSampleDuty.Value() == 0 || KnobSampleDuty.Value() >= 100 )
+        return;
+
+    LOGI("Sampling " << KnobSampleWindow.Value() << "ms windows at " << KnobSampleDuty.Value() << "% duty cycle");
+    sample_enabled = TRUE;
+    sample_windowBegin = GetTimeMs();
+
+    if ( PIN_SpawnInternalThread(Inscount_Sampler, 0, 0, &sample_uid) == INVALID_THREADID )
+    {
+        ERROR("Failed to start the sampler thread, instrumenting the whole run");
+        sample_enabled = FALSE;
+        return;
+    }
+    PIN_AddThreadFiniFunction(Inscount_SampleThreadFini, 0);
+    PIN_AddPrepareForFiniFunction(Inscount_PrepareForFini, 0);
+}
+
+VOID Inscount_PrepareForFini(VOID *v)
+{
+    sample_stop = TRUE;
+    PIN_WaitForThreadTermination(sample_uid, PIN_INFINITE_TIMEOUT, 0);
+
+    // Account for the window the program ended in
+    if ( sample_on )
+        Inscount_SampleWindowEnd();
+}
+
+// Sampling columns for the CSV header
+static const char * Inscount_SampleHeader()
+{
+    return sample_enabled ? ",Estimated,ErrorBound,Windows" : "";
+}
+
+// Extrapolated instruction count of a thread with its 95% error bound
+static string Inscount_SampleColumns(thread_data_t* tdata)
+{
+    if ( !sample_enabled )
+        return "";
+
+    UINT64 end = tdata->_sampleEnd ? tdata->_sampleEnd : GetTimeMs();
+    double elapsed = (double)(end - tdata->_sampleBegin);
+    double scale = tdata->_sampleOnTime ? elapsed / tdata->_sampleOnTime : 1.0;
+    double estimate = tdata->_count * scale;
+    double bound = 0;
+    if ( tdata->_windows > 1 )
+    {
+        double n = tdata->_windows;
+        double mean = tdata->_rateSum / n;
+        double var = (tdata->_rateSqSum - n * mean * mean) / (n - 1);
+        if (var > 0)
+            bound = 1.96 * sqrt(var / n) * elapsed;
+    }
+
+    char buf[128];
+    sprintf(buf, ",%.0f,%.0f,%u", estimate, bound, tdata->_windows);
+    return buf;
+}
+
 //
 // Inscount Base implemention
 //
@@ -119,6 +318,13 @@ VOID PIN_FAST_ANALYSIS_CALL inscount_docount(UINT32 c, THREADID threadid)
     tdata->_count += c;
 }
 
+// Same as inscount_docount but the thread data comes in the tool register.
+// Small enough to be inlined by Pin.
+VOID PIN_FAST_ANALYSIS_CALL inscount_docount_reg(UINT32 c, thread_data_t* tdata)
+{
+    tdata->_count += c;
+}
+
 VOID Inscount_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
 {
     GetLock(&lock, threadid+1);
@@ -126,21 +332,43 @@ VOID Inscount_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v
     ReleaseLock(&lock);
 
     thread_data_t* tdata = new thread_data_t;
+    tdata->_sampleBegin = GetTimeMs();
 
     PIN_SetThreadData(tls_key, tdata, threadid);
+
+    // The register is per thread, so each thread starts with its own data
+    if ( REG_valid(tls_reg) )
+        PIN_SetContextReg(ctxt, tls_reg, (ADDRINT)tdata);
 }
 
 // Pin calls this function every time a new basic block is encountered.
-// It inserts a call to docount.
+// It inserts a call to docount. Tools built on top of inscount can pass an
+// inscount_bbl_hook as v to instrument each BBL on their own.
 VOID Inscount_Trace(TRACE trace, VOID *v)
 {
+    inscount_bbl_hook hook = reinterpret_cast<inscount_bbl_hook>(v);
+
+    // Outside of a sampling window the code runs uninstrumented
+    if ( !sample_on )
+        return;
+
     // Visit every basic block  in the trace
     for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
     {
+        // Filtered code runs uninstrumented
+        if ( !Filter_Bbl(bbl) )
+            continue;
+
         // Insert a call to docount for every bbl, passing the number of instructions.
-        
-        BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)inscount_docount, IARG_FAST_ANALYSIS_CALL,
-                       IARG_UINT32, BBL_NumIns(bbl), IARG_THREAD_ID, IARG_END);
+        if ( REG_valid(tls_reg) )
+            BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)inscount_docount_reg, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, BBL_NumIns(bbl), IARG_REG_VALUE, tls_reg, IARG_END);
+        else
+            BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)inscount_docount, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, BBL_NumIns(bbl), IARG_THREAD_ID, IARG_END);
+
+        if ( hook )
+            hook(bbl);
     }
 }
 
@@ -149,14 +377,15 @@ VOID Inscount_Fini(INT32 code, VOID *v)
 {
     GetLock(&OutFileLock, BASE_LOCK_TAG);
     // Write to a file since cout and cerr maybe closed by the application
-    OutFile << "Id,Instructions" << endl;
+    OutFile << "Id,Instructions" << Inscount_SampleHeader() << endl;
     
     for (INT32 t=0; t<numThreads; t++)
     {
         thread_data_t* tdata = get_tls(t);
-        OutFile << decstr(t) << "," << tdata->_count << endl;
+        OutFile << decstr(t) << "," << tdata->_count << Inscount_SampleColumns(tdata) << endl;
     }
 
+    Filter_Report(OutFile);
     OutFile.close();
     ReleaseLock(&OutFileLock);
 }
@@ -164,93 +393,322 @@ VOID Inscount_Fini(INT32 code, VOID *v)
 //
 // Inscount Extended implementation
 //
+// Everything that is known at instrumentation time (instruction, memory
+// operand and unconditional branch counts) is summed up per BBL and applied
+// with a single call. Only predicated instructions and conditional branches
+// need their own call since their effect depends on the execution.
 
-// Record memory reads for this thread
-VOID RecordMemRead(THREADID threadid)
+// Apply the static counts of a BBL
+VOID PIN_FAST_ANALYSIS_CALL inscount_ext_docount(UINT32 c, UINT32 reads, UINT32 writes, UINT32 branches, THREADID threadid)
 {
     thread_data_t* tdata = get_tls(threadid);
-    tdata->_reads++;
+    tdata->_count += c;
+    tdata->_reads += reads;
+    tdata->_writes += writes;
+    tdata->_branches += branches;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL inscount_ext_docount_reg(UINT32 c, UINT32 reads, UINT32 writes, UINT32 branches, thread_data_t* tdata)
+{
+    tdata->_count += c;
+    tdata->_reads += reads;
+    tdata->_writes += writes;
+    tdata->_branches += branches;
+}
+
+// Apply the instruction mix of a BBL, only called for BBLs with FP code.
+// The classes come in as arguments, one per MIX_ class.
+static inline VOID Inscount_Mix(thread_data_t* tdata, UINT32 scalar, UINT32 sse, UINT32 avx, UINT32 avx2,
+                                UINT32 avx512, UINT32 vec128, UINT32 vec256, UINT32 vec512)
+{
+    tdata->_mix[MIX_SCALAR_FP] += scalar;
+    tdata->_mix[MIX_SSE] += sse;
+    tdata->_mix[MIX_AVX] += avx;
+    tdata->_mix[MIX_AVX2] += avx2;
+    tdata->_mix[MIX_AVX512] += avx512;
+    tdata->_mix[MIX_VEC128] += vec128;
+    tdata->_mix[MIX_VEC256] += vec256;
+    tdata->_mix[MIX_VEC512] += vec512;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL inscount_mix_docount(UINT32 scalar, UINT32 sse, UINT32 avx, UINT32 avx2, UINT32 avx512,
+                                                 UINT32 vec128, UINT32 vec256, UINT32 vec512, THREADID threadid)
+{
+    Inscount_Mix(get_tls(threadid), scalar, sse, avx, avx2, avx512, vec128, vec256, vec512);
 }
 
-// Record memory writes for this thread
-VOID RecordMemWrite(THREADID threadid)
+VOID PIN_FAST_ANALYSIS_CALL inscount_mix_docount_reg(UINT32 scalar, UINT32 sse, UINT32 avx, UINT32 avx2, UINT32 avx512,
+                                                     UINT32 vec128, UINT32 vec256, UINT32 vec512, thread_data_t* tdata)
+{
+    Inscount_Mix(tdata, scalar, sse, avx, avx2, avx512, vec128, vec256, vec512);
+}
+
+// Predicated instruction that got executed, records its memory accesses
+VOID PIN_FAST_ANALYSIS_CALL PredicatedCount(UINT32 reads, UINT32 writes, THREADID threadid)
 {
     thread_data_t* tdata = get_tls(threadid);
-    tdata->_writes++;
+    tdata->_reads += reads;
+    tdata->_writes += writes;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL PredicatedCount_reg(UINT32 reads, UINT32 writes, thread_data_t* tdata)
+{
+    tdata->_reads += reads;
+    tdata->_writes += writes;
 }
 
-VOID BranchCount( INT32 taken, THREADID threadid)
+// Outcome of a conditional branch
+VOID PIN_FAST_ANALYSIS_CALL BranchCount(INT32 taken, THREADID threadid)
 {
     if( !taken ) return;
     thread_data_t* tdata = get_tls(threadid);
     tdata->_branches++;
 }
 
-VOID FloatOpsCount(THREADID threadid)
+VOID PIN_FAST_ANALYSIS_CALL BranchCount_reg(INT32 taken, thread_data_t* tdata)
 {
-    thread_data_t* tdata = get_tls(threadid);
-    tdata->_floatOps++;
+    tdata->_branches += (taken != 0);
 }
 
-VOID Inscount_Ext_Instruction(INS ins, void *v)
+// Floating point work: an FP element type on some operand, which leaves
+// out integer SIMD (pxor, pcmpeqb, vpshufb), and not just moving, masking
+// or broadcasting the values (movss, movaps, fcmovb, andps, vbroadcastss).
+static BOOL Inscount_IsFloat(INS ins, xed_decoded_inst_t *xedd)
 {
-    // Count the number of branches
-    if (INS_IsDirectBranchOrCall(ins))
+    switch (INS_Category(ins))
     {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) BranchCount, 
-                       IARG_BRANCH_TAKEN,
-                       IARG_THREAD_ID,
-                       IARG_END);          
+        case XED_CATEGORY_DATAXFER:
+        case XED_CATEGORY_FCMOV:
+        case XED_CATEGORY_LOGICAL_FP:
+        case XED_CATEGORY_BROADCAST:
+            return FALSE;
     }
-    
-    // Count the number of predicted instructions (float point, not 100% accurate!)
-    else if ( INS_IsPredicated(ins) )
+
+    for (UINT32 i = 0; i < xed_decoded_inst_noperands(xedd); i++)
+    {
+        switch (xed_decoded_inst_operand_element_type(xedd, i))
+        {
+            case XED_OPERAND_ELEMENT_TYPE_SINGLE:
+            case XED_OPERAND_ELEMENT_TYPE_DOUBLE:
+            case XED_OPERAND_ELEMENT_TYPE_LONGDOUBLE:
+            case XED_OPERAND_ELEMENT_TYPE_FLOAT16:
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+UINT32 Inscount_Classify(INS ins, UINT32 *width)
+{
+    xed_decoded_inst_t *xedd = INS_XedDec(ins);
+    BOOL scalar = xed_decoded_inst_get_attribute(xedd, XED_ATTRIBUTE_SIMD_SCALAR) != 0;
+    UINT32 mix;
+
+    *width = 0;
+    if ( !Inscount_IsFloat(ins, xedd) )
+        return MIX_NONE;
+
+    switch (INS_Extension(ins))
     {
-        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)FloatOpsCount, IARG_THREAD_ID, IARG_END); 
+        case XED_EXTENSION_X87:
+            return MIX_SCALAR_FP;
+        case XED_EXTENSION_SSE:
+        case XED_EXTENSION_SSE2:
+        case XED_EXTENSION_SSE3:
+        case XED_EXTENSION_SSSE3:
+        case XED_EXTENSION_SSE4:
+        case XED_EXTENSION_SSE4A:
+            mix = MIX_SSE;
+            break;
+        case XED_EXTENSION_AVX:
+        case XED_EXTENSION_F16C:
+            mix = MIX_AVX;
+            break;
+        case XED_EXTENSION_AVX2:
+        case XED_EXTENSION_AVX2GATHER:
+        case XED_EXTENSION_FMA:
+            mix = MIX_AVX2;
+            break;
+        case XED_EXTENSION_AVX512EVEX:
+            mix = MIX_AVX512;
+            break;
+        default:
+            return MIX_NONE;
     }
 
-    // Instruments memory accesses using a predicated call, i.e.
-    // the instrumentation is called iff the instruction will actually be executed.
+    // Scalar SSE/AVX arithmetic (addsd, vfmadd231ss, ...) is not vectorized
+    if ( scalar )
+        return MIX_SCALAR_FP;
+
+    *width = (mix == MIX_SSE) ? 128 : xed_decoded_inst_vector_length_bits(xedd);
+    return mix;
+}
+
+VOID Inscount_Ext_Instruction(INS ins, inscount_bbl_t *counts)
+{
+    // Instruction mix. The only predicated FP instructions are the x87
+    // FCMOVcc moves, which are left out of it, so it is always part of
+    // the BBL counts
+    UINT32 width;
+    UINT32 mix = Inscount_Classify(ins, &width);
+    if ( mix != MIX_NONE )
+    {
+        counts->_mix[mix]++;
+        if ( width == 128 )
+            counts->_mix[MIX_VEC128]++;
+        else if ( width == 256 )
+            counts->_mix[MIX_VEC256]++;
+        else if ( width == 512 )
+            counts->_mix[MIX_VEC512]++;
+    }
+
+    // Memory operands of the instruction. Note that in some architectures a
+    // single memory operand can be both read and written (for instance
+    // incl (%eax) on IA-32), in that case it is counted once for read and
+    // once for write.
+    UINT32 reads = 0;
+    UINT32 writes = 0;
+    UINT32 memOperands = INS_MemoryOperandCount(ins);
+    for (UINT32 memOp = 0; memOp < memOperands; memOp++)
+    {
+        if (INS_MemoryOperandIsRead(ins, memOp))
+            reads++;
+        if (INS_MemoryOperandIsWritten(ins, memOp))
+            writes++;
+    }
+
+    // Count the memory accesses of predicated instructions on their own.
     //
     // The IA-64 architecture has explicitly predicated instructions. 
     // On the IA-32 and Intel(R) 64 architectures conditional moves and REP 
-    // prefixed instructions appear as predicated instructions in Pin.
-    UINT32 memOperands = INS_MemoryOperandCount(ins);
+    // prefixed instructions appear as predicated instructions in Pin. Their
+    // memory accesses only happen iff the instruction is actually executed.
+    if ( INS_IsPredicated(ins) )
+    {
+        if ( REG_valid(tls_reg) )
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)PredicatedCount_reg, IARG_FAST_ANALYSIS_CALL,
+                                     IARG_UINT32, reads, IARG_UINT32, writes,
+                                     IARG_REG_VALUE, tls_reg, IARG_END);
+        else
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)PredicatedCount, IARG_FAST_ANALYSIS_CALL,
+                                     IARG_UINT32, reads, IARG_UINT32, writes,
+                                     IARG_THREAD_ID, IARG_END);
+    }
+    else
+    {
+        counts->_reads += reads;
+        counts->_writes += writes;
+    }
 
-    // Iterate over each memory operand of the instruction.
-    for (UINT32 memOp = 0; memOp < memOperands; memOp++)
+    // Count the number of taken branches. Direct calls and jumps are always
+    // taken, only conditional ones have to look at the outcome.
+    if (INS_IsDirectBranchOrCall(ins))
     {
-        if (INS_MemoryOperandIsRead(ins, memOp))
+        if ( INS_Category(ins) != XED_CATEGORY_COND_BR )
         {
-            INS_InsertPredicatedCall(
-                ins, IPOINT_BEFORE, (AFUNPTR)RecordMemRead, IARG_THREAD_ID,
-                IARG_END);
+            counts->_branches++;
         }
-        // Note that in some architectures a single memory operand can be 
-        // both read and written (for instance incl (%eax) on IA-32)
-        // In that case we instrument it once for read and once for write.
-        if (INS_MemoryOperandIsWritten(ins, memOp))
+        else if ( REG_valid(tls_reg) )
+        {
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) BranchCount_reg, 
+                           IARG_FAST_ANALYSIS_CALL,
+                           IARG_BRANCH_TAKEN,
+                           IARG_REG_VALUE, tls_reg,
+                           IARG_END);
+        }
+        else
         {
-            INS_InsertPredicatedCall(
-                ins, IPOINT_BEFORE, (AFUNPTR)RecordMemWrite, IARG_THREAD_ID,
-                IARG_END);
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) BranchCount, 
+                           IARG_FAST_ANALYSIS_CALL,
+                           IARG_BRANCH_TAKEN,
+                           IARG_THREAD_ID,
+                           IARG_END);
         }
     }
 }
 
+// Trace instrumentation for the extended inscount, one call per BBL
+VOID Inscount_Ext_Trace(TRACE trace, VOID *v)
+{
+    if ( !sample_on )
+        return;
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if ( !Filter_Bbl(bbl) )
+            continue;
+
+        inscount_bbl_t counts;
+        counts._reads = 0;
+        counts._writes = 0;
+        counts._branches = 0;
+        memset(counts._mix, 0, sizeof(counts._mix));
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            Inscount_Ext_Instruction(ins, &counts);
+        }
+
+        if ( REG_valid(tls_reg) )
+            BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)inscount_ext_docount_reg, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, BBL_NumIns(bbl),
+                           IARG_UINT32, counts._reads, IARG_UINT32, counts._writes, IARG_UINT32, counts._branches,
+                           IARG_REG_VALUE, tls_reg, IARG_END);
+        else
+            BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)inscount_ext_docount, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, BBL_NumIns(bbl),
+                           IARG_UINT32, counts._reads, IARG_UINT32, counts._writes, IARG_UINT32, counts._branches,
+                           IARG_THREAD_ID, IARG_END);
+
+        // Most BBLs have no FP code and need no mix call at all
+        BOOL hasMix = FALSE;
+        for (UINT32 i = 0; i < MIX_NUM; i++)
+            hasMix |= counts._mix[i] != 0;
+        if ( !hasMix )
+            continue;
+
+        UINT32 *mix = counts._mix;
+        if ( REG_valid(tls_reg) )
+            BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)inscount_mix_docount_reg, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, mix[MIX_SCALAR_FP], IARG_UINT32, mix[MIX_SSE], IARG_UINT32, mix[MIX_AVX],
+                           IARG_UINT32, mix[MIX_AVX2], IARG_UINT32, mix[MIX_AVX512], IARG_UINT32, mix[MIX_VEC128],
+                           IARG_UINT32, mix[MIX_VEC256], IARG_UINT32, mix[MIX_VEC512],
+                           IARG_REG_VALUE, tls_reg, IARG_END);
+        else
+            BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)inscount_mix_docount, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, mix[MIX_SCALAR_FP], IARG_UINT32, mix[MIX_SSE], IARG_UINT32, mix[MIX_AVX],
+                           IARG_UINT32, mix[MIX_AVX2], IARG_UINT32, mix[MIX_AVX512], IARG_UINT32, mix[MIX_VEC128],
+                           IARG_UINT32, mix[MIX_VEC256], IARG_UINT32, mix[MIX_VEC512],
+                           IARG_THREAD_ID, IARG_END);
+    }
+}
+
 // This function is called when the application exits
 VOID Inscount_Ext_Fini(INT32 code, VOID *v)
 {
     GetLock(&OutFileLock, BASE_LOCK_TAG);
     // Write to a file since cout and cerr maybe closed by the application
-    OutFile << "Id,Instructions,Reads,Writes,Branches,FloatPoint" << endl;
+    OutFile << "Id,Instructions,Reads,Writes,Branches,FloatPoint,"
+            << "ScalarFP,SSE,AVX,AVX2,AVX512,Vec128,Vec256,Vec512,VectorizationRatio"
+            << Inscount_SampleHeader() << endl;
     
     for (INT32 t=0; t<numThreads; t++)
     {
         thread_data_t* tdata = get_tls(t);
-        OutFile << decstr(t) << "," << tdata->_count << "," << tdata->_reads << "," << tdata->_writes << "," << tdata->_branches << "," << tdata->_floatOps << endl;
+        UINT64 *mix = tdata->_mix;
+
+        // Share of the FP work done by vector instructions
+        UINT64 vector = mix[MIX_VEC128] + mix[MIX_VEC256] + mix[MIX_VEC512];
+        UINT64 floatOps = mix[MIX_SCALAR_FP] + mix[MIX_SSE] + mix[MIX_AVX] + mix[MIX_AVX2] + mix[MIX_AVX512];
+        double ratio = (vector + mix[MIX_SCALAR_FP]) ? (double)vector / (vector + mix[MIX_SCALAR_FP]) : 0.0;
+
+        OutFile << decstr(t) << "," << tdata->_count << "," << tdata->_reads << "," << tdata->_writes << "," << tdata->_branches << "," << floatOps;
+        for (UINT32 i = 0; i < MIX_NUM; i++)
+            OutFile << "," << mix[i];
+        OutFile << "," << ratio << Inscount_SampleColumns(tdata) << endl;
     }
 
+    Filter_Report(OutFile);
     OutFile.close();
     ReleaseLock(&OutFileLock);
 }
\ No newline at end of file
@@ -44,25 +44,103 @@ BOOL inscount_ext(INT32 toolId);
 // This avoids the false sharing problem.
 #define PADSIZE 56  // 64 byte line size: 64-8
 
+// Instruction mix classes of the extended inscount. Every FP
+// instruction counts for one ISA class, vector instructions additionally
+// for their vector width.
+#define MIX_SCALAR_FP 0     // x87 and scalar SSE/AVX arithmetic
+#define MIX_SSE 1
+#define MIX_AVX 2
+#define MIX_AVX2 3          // includes FMA
+#define MIX_AVX512 4
+#define MIX_VEC128 5
+#define MIX_VEC256 6
+#define MIX_VEC512 7
+#define MIX_NUM 8
+#define MIX_NONE MIX_NUM
+
 // a running count of the instructions
 class thread_data_t
 {
   public:
-    thread_data_t() : _count(0) {}
+    thread_data_t() : _count(0), _reads(0), _writes(0), _branches(0),
+        _sampleStart(0), _rateSum(0), _rateSqSum(0), _windows(0),
+        _sampleBegin(0), _sampleEnd(0), _sampleOnTime(0), _tool(0)
+    {
+        memset(_mix, 0, sizeof(_mix));
+    }
     UINT64 _count;
     UINT8 _pad[PADSIZE];
     UINT64 _reads;
     UINT64 _writes;
     UINT64 _branches;
-    UINT64 _floatOps;
+    UINT64 _mix[MIX_NUM];
+
+    // Executions of each BBL, used by the bblprof tool
+    counter_table_t _bbls;
+
+    // Calls and instructions of each routine, used by proccount
+    counter_table_t _rtnCalls;
+    counter_table_t _rtnIns;
+
+    // Sampling state, touched by the sampler thread and at thread exit
+    UINT64 _sampleStart;    // count when the current window started
+    double _rateSum;        // sum of instructions per ms of each window
+    double _rateSqSum;      // sum of the squared rates
+    UINT32 _windows;        // windows seen by this thread
+    UINT64 _sampleBegin;    // ms, thread start
+    UINT64 _sampleEnd;      // ms, thread exit or 0 while running
+    UINT64 _sampleOnTime;   // ms this thread ran instrumented
+
+    // Per-thread state of the tool built on top of inscount
+    VOID *_tool;
 };
 
+// Static counts of a BBL gathered at instrumentation time by the extended
+// inscount
+typedef struct InscountBbl
+{
+    UINT32 _reads;
+    UINT32 _writes;
+    UINT32 _branches;
+    UINT32 _mix[MIX_NUM];
+} inscount_bbl_t;
+
+// Per BBL instrumentation of tools built on top of Inscount_Trace
+typedef VOID (*inscount_bbl_hook)(BBL bbl);
+
+// Number of threads seen so far, thread ids go from 0 to numThreads-1
+extern INT32 numThreads;
+
+/** Setup the per-thread counters, used by all tools built on top of inscount */
+VOID Inscount_Init();
+
+/** Register passing the thread data to the analysis routines, invalid when using the TLS */
+REG Inscount_ToolReg();
+
+/** ISA class of an FP instruction (MIX_NONE if no FP work), width gets the vector width in bits or 0 */
+UINT32 Inscount_Classify(INS ins, UINT32 *width);
+
 /** Get the datacainer of the given thread */
 thread_data_t* get_tls(THREADID threadid);
 
+/** Claim the tool register used for the thread data if enabled */
+VOID Inscount_ClaimToolReg();
+
+/** Start the sampler thread if sampling is enabled */
+VOID Inscount_StartSampling();
+
+/** Closes the instrumented time of an exiting thread */
+VOID Inscount_SampleThreadFini(THREADID threadid, const CONTEXT *ctxt, INT32 code, VOID *v);
+
+/** Stops the sampler thread before the Fini callbacks run */
+VOID Inscount_PrepareForFini(VOID *v);
+
 /** Counts of instruction within a BBL */
 VOID PIN_FAST_ANALYSIS_CALL inscount_docount(UINT32 c, THREADID threadid);
 
+/** Counts of instruction within a BBL, thread data passed in a register */
+VOID PIN_FAST_ANALYSIS_CALL inscount_docount_reg(UINT32 c, thread_data_t* tdata);
+
 /** Catches when a thread gets started */
 VOID Inscount_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
 
@@ -72,8 +150,11 @@ VOID Inscount_Trace(TRACE trace, VOID *v);
 /** Finish callback for basic inscount */
 VOID Inscount_Fini(INT32 code, VOID *v);
 
-/** Instruction instrumentation callback for extended inscount */
-VOID Inscount_Ext_Instruction(INS ins, void *v);
+/** Trace instrumentation callback for extended inscount */
+VOID Inscount_Ext_Trace(TRACE trace, VOID *v);
+
+/** Instrument a single instruction for extended inscount, static counts are added to the BBL counts */
+VOID Inscount_Ext_Instruction(INS ins, inscount_bbl_t *counts);
 
 /** Finish callback for extended inscount */
 VOID Inscount_Ext_Fini(INT32 code, VOID *v);
@@ -0,0 +1,391 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_lockprof.h"
+
+#include <sys/syscall.h>
+
+//
+// Tool Registration
+//
+
+BOOL lockprof(INT32 toolId)
+{
+    if ( toolId == TOOL_LOCKPROF )
+    {
+        LOGI("Registering callbacks for lockprof");
+
+        // Waits and critical sections are also measured in instructions
+        // of the thread, counted by inscount
+        Inscount_Init();
+        TRACE_AddInstrumentFunction(Inscount_Trace, 0);
+
+        PIN_AddThreadStartFunction(LockProf_ThreadStart, 0);
+        IMG_AddInstrumentFunction(LockProf_ImageLoad, 0);
+        PIN_AddSyscallEntryFunction(LockProf_SyscallEntry, 0);
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(LockProf_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// Lock profiler implementation
+//
+// The pthread lock routines are hooked like the heap routines of
+// malloctrace. The time between entering a lock routine and returning
+// with the lock is the wait, the time until the matching unlock the
+// critical section, both in wall time and in instructions of the thread.
+// An acquisition is contended when the thread went to sleep on a futex
+// inside the call, or for spin locks when it spun. Failed trylocks are
+// counted on their own, so are timed locks that timed out, whose wait
+// still counts.
+//
+// A condition wait releases its mutex on entry and holds it again on
+// return, the time in between is counted as condition wait, not as
+// lock wait. Statistics are kept per thread by lock and call site.
+
+static struct
+{
+    const char * _name;
+    UINT32 _kind;
+} LockHooks[] = {
+    { "pthread_mutex_lock", LOCK_KIND_MUTEX_LOCK },
+    { "pthread_mutex_trylock", LOCK_KIND_MUTEX_TRYLOCK },
+    { "pthread_mutex_timedlock", LOCK_KIND_MUTEX_TIMEDLOCK },
+    { "pthread_mutex_unlock", LOCK_KIND_MUTEX_UNLOCK },
+    { "pthread_rwlock_rdlock", LOCK_KIND_RWLOCK_RDLOCK },
+    { "pthread_rwlock_wrlock", LOCK_KIND_RWLOCK_WRLOCK },
+    { "pthread_rwlock_tryrdlock", LOCK_KIND_RWLOCK_TRYRDLOCK },
+    { "pthread_rwlock_trywrlock", LOCK_KIND_RWLOCK_TRYWRLOCK },
+    { "pthread_rwlock_timedrdlock", LOCK_KIND_RWLOCK_TIMEDRDLOCK },
+    { "pthread_rwlock_timedwrlock", LOCK_KIND_RWLOCK_TIMEDWRLOCK },
+    { "pthread_rwlock_unlock", LOCK_KIND_RWLOCK_UNLOCK },
+    { "pthread_cond_wait", LOCK_KIND_COND_WAIT },
+    { "pthread_cond_timedwait", LOCK_KIND_COND_TIMEDWAIT },
+    { "pthread_spin_lock", LOCK_KIND_SPIN_LOCK },
+    { "pthread_spin_trylock", LOCK_KIND_SPIN_TRYLOCK },
+    { "pthread_spin_unlock", LOCK_KIND_SPIN_UNLOCK },
+};
+
+static const char* LockTypeNames[] = { "mutex", "rwlock", "spin" };
+
+static lock_thread_t* get_lockprof(THREADID threadid)
+{
+    return static_cast<lock_thread_t*>(get_tls(threadid)->_tool);
+}
+
+static UINT32 LockProf_Type(UINT32 kind)
+{
+    if ( kind >= LOCK_KIND_SPIN_LOCK )
+        return LOCK_TYPE_SPIN;
+    if ( kind >= LOCK_KIND_RWLOCK_RDLOCK && kind <= LOCK_KIND_RWLOCK_UNLOCK )
+        return LOCK_TYPE_RWLOCK;
+    return LOCK_TYPE_MUTEX;
+}
+
+VOID LockProf_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    get_tls(threadid)->_tool = new lock_thread_t();
+}
+
+static lock_stats_t& LockProf_Stats(lock_thread_t* lt, ADDRINT lock, ADDRINT site, UINT32 type)
+{
+    std::pair<ADDRINT, ADDRINT> key(lock, site);
+    std::map<std::pair<ADDRINT, ADDRINT>, lock_stats_t>::iterator it = lt->_stats.find(key);
+    if ( it == lt->_stats.end() )
+    {
+        // The call site may be in a library closed before Fini
+        SourceLocation_Record(site);
+        it = lt->_stats.insert(std::make_pair(key, lock_stats_t())).first;
+    }
+    it->second._type = type;
+    return it->second;
+}
+
+// The thread got the lock, its critical section starts
+static VOID LockProf_Acquired(lock_thread_t* lt, ADDRINT lock, ADDRINT site, UINT64 ins, UINT64 ns)
+{
+    lock_hold_t hold;
+    hold._site = site;
+    hold._startIns = ins;
+    hold._startNs = ns;
+    lt->_held[lock] = hold;
+}
+
+// The thread gives the lock up, charge the critical section to the site
+// that acquired it
+static VOID LockProf_Released(lock_thread_t* lt, ADDRINT lock, UINT32 type, UINT64 ins, UINT64 ns)
+{
+    std::map<ADDRINT, lock_hold_t>::iterator it = lt->_held.find(lock);
+    if ( it == lt->_held.end() )
+        return;
+
+    lock_stats_t &stats = LockProf_Stats(lt, lock, it->second._site, type);
+    stats._holdIns += ins - it->second._startIns;
+    stats._holdNs += ns - it->second._startNs;
+    lt->_held.erase(it);
+}
+
+VOID LockProf_Enter(UINT32 kind, ADDRINT arg0, ADDRINT arg1, ADDRINT sp, ADDRINT retIp, THREADID threadid)
+{
+    lock_thread_t* lt = get_lockprof(threadid);
+
+    // Drop the frames a longjmp or cancellation left behind, as
+    // malloctrace does. Calls deeper than we keep have no frame.
+    while ( lt->_depth > 0 && lt->_depth <= LOCKPROF_MAX_DEPTH )
+    {
+        lock_call_t *top = &lt->_calls[lt->_depth - 1];
+        if ( top->_sp > sp || (top->_sp == sp && top->_site == retIp) )
+            break;
+        lt->_depth--;
+    }
+
+    if ( lt->_depth++ )
+    {
+        // Only the outermost call counts, remember the frame to pop it
+        if ( lt->_depth <= LOCKPROF_MAX_DEPTH )
+        {
+            lt->_calls[lt->_depth - 1]._sp = sp;
+            lt->_calls[lt->_depth - 1]._site = retIp;
+        }
+        return;
+    }
+
+    lock_call_t *call = &lt->_calls[0];
+    call->_kind = kind;
+    call->_lock = arg0;
+    call->_mutex = arg1;
+    call->_site = retIp;
+    call->_sp = sp;
+    call->_startIns = get_tls(threadid)->_count;
+    call->_startNs = GetTimeNs();
+    call->_futex = FALSE;
+
+    UINT32 type = LockProf_Type(kind);
+    switch ( kind )
+    {
+        case LOCK_KIND_MUTEX_UNLOCK:
+        case LOCK_KIND_RWLOCK_UNLOCK:
+        case LOCK_KIND_SPIN_UNLOCK:
+            LockProf_Released(lt, arg0, type, call->_startIns, call->_startNs);
+            break;
+        case LOCK_KIND_COND_WAIT:
+        case LOCK_KIND_COND_TIMEDWAIT:
+            LockProf_Released(lt, arg1, LOCK_TYPE_MUTEX, call->_startIns, call->_startNs);
+            break;
+    }
+}
+
+static VOID LockProf_Complete(THREADID threadid, lock_thread_t* lt, lock_call_t *call, ADDRINT ret)
+{
+    UINT64 ins = get_tls(threadid)->_count;
+    UINT64 ns = GetTimeNs();
+    UINT32 type = LockProf_Type(call->_kind);
+
+    switch ( call->_kind )
+    {
+        case LOCK_KIND_MUTEX_TRYLOCK:
+        case LOCK_KIND_RWLOCK_TRYRDLOCK:
+        case LOCK_KIND_RWLOCK_TRYWRLOCK:
+        case LOCK_KIND_SPIN_TRYLOCK:
+            if ( ret )
+            {
+                LockProf_Stats(lt, call->_lock, call->_site, type)._failedTries++;
+                break;
+            }
+            // Fall through, the try got the lock
+        case LOCK_KIND_MUTEX_TIMEDLOCK:
+        case LOCK_KIND_RWLOCK_TIMEDRDLOCK:
+        case LOCK_KIND_RWLOCK_TIMEDWRLOCK:
+            if ( ret )
+            {
+                // Timed out, the thread waited without getting the lock
+                lock_stats_t &stats = LockProf_Stats(lt, call->_lock, call->_site, type);
+                stats._failedTries++;
+                stats._waitIns += ins - call->_startIns;
+                stats._waitNs += ns - call->_startNs;
+                break;
+            }
+            // Fall through, the lock was acquired in time
+        case LOCK_KIND_MUTEX_LOCK:
+        case LOCK_KIND_RWLOCK_RDLOCK:
+        case LOCK_KIND_RWLOCK_WRLOCK:
+        case LOCK_KIND_SPIN_LOCK:
+        {
+            if ( ret )
+                break;
+            lock_stats_t &stats = LockProf_Stats(lt, call->_lock, call->_site, type);
+            stats._acquisitions++;
+            stats._waitIns += ins - call->_startIns;
+            stats._waitNs += ns - call->_startNs;
+            if ( call->_futex || (type == LOCK_TYPE_SPIN && ins - call->_startIns > LOCKPROF_SPIN_INSTRUCTIONS) )
+                stats._contended++;
+            LockProf_Acquired(lt, call->_lock, call->_site, ins, ns);
+            break;
+        }
+        case LOCK_KIND_COND_WAIT:
+        case LOCK_KIND_COND_TIMEDWAIT:
+        {
+            // The mutex is held again whatever the wait returned
+            lock_stats_t &stats = LockProf_Stats(lt, call->_mutex, call->_site, LOCK_TYPE_MUTEX);
+            stats._acquisitions++;
+            stats._condWaits++;
+            stats._condWaitNs += ns - call->_startNs;
+            LockProf_Acquired(lt, call->_mutex, call->_site, ins, ns);
+            break;
+        }
+    }
+}
+
+VOID LockProf_Exit(ADDRINT ret, ADDRINT sp, THREADID threadid)
+{
+    lock_thread_t* lt = get_lockprof(threadid);
+    while ( lt->_depth > 0 )
+    {
+        // Calls deeper than we keep have no frame, they return first
+        if ( lt->_depth <= LOCKPROF_MAX_DEPTH && lt->_calls[lt->_depth - 1]._sp > sp )
+            break;
+        if ( --lt->_depth == 0 )
+            LockProf_Complete(threadid, lt, &lt->_calls[0], ret);
+    }
+}
+
+VOID LockProf_SyscallEntry(THREADID threadid, CONTEXT *ctxt, SYSCALL_STANDARD std, VOID *v)
+{
+    lock_thread_t* lt = get_lockprof(threadid);
+    if ( lt->_depth && PIN_GetSyscallNumber(ctxt, std) == SYS_futex )
+        lt->_calls[0]._futex = TRUE;
+}
+
+VOID LockProf_ImageLoad(IMG img, VOID *v)
+{
+    for (UINT32 i = 0; i < sizeof(LockHooks) / sizeof(LockHooks[0]); i++)
+    {
+        RTN rtn = RTN_FindByName(img, LockHooks[i]._name);
+        if ( !RTN_Valid( rtn ))
+            continue;
+
+        RTN_Open(rtn);
+        RTN_InsertCall(rtn, IPOINT_BEFORE, AFUNPTR(LockProf_Enter),
+            IARG_UINT32, LockHooks[i]._kind,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+            IARG_REG_VALUE, REG_STACK_PTR,
+            IARG_RETURN_IP,
+            IARG_THREAD_ID, IARG_END);
+        RTN_InsertCall(rtn, IPOINT_AFTER, AFUNPTR(LockProf_Exit),
+            IARG_FUNCRET_EXITPOINT_VALUE,
+            IARG_REG_VALUE, REG_STACK_PTR,
+            IARG_THREAD_ID, IARG_END);
+        RTN_Close(rtn);
+    }
+}
+
+// Locks by wait time, contended acquisitions break ties
+static bool LockProf_Compare(const std::pair<ADDRINT, lock_stats_t> &a, const std::pair<ADDRINT, lock_stats_t> &b)
+{
+    if ( a.second._waitNs != b.second._waitNs )
+        return a.second._waitNs > b.second._waitNs;
+    return a.second._contended > b.second._contended;
+}
+
+static VOID LockProf_Merge(lock_stats_t &to, const lock_stats_t &from)
+{
+    to._type = from._type;
+    to._acquisitions += from._acquisitions;
+    to._contended += from._contended;
+    to._failedTries += from._failedTries;
+    to._waitIns += from._waitIns;
+    to._waitNs += from._waitNs;
+    to._holdIns += from._holdIns;
+    to._holdNs += from._holdNs;
+    to._condWaits += from._condWaits;
+    to._condWaitNs += from._condWaitNs;
+}
+
+static VOID LockProf_Columns(const lock_stats_t &s)
+{
+    OutFile << LockTypeNames[s._type] << "," << s._acquisitions << "," << s._contended << "," << s._failedTries << ","
+            << s._waitIns << "," << s._waitNs / 1000000.0 << "," << s._holdIns << "," << s._holdNs / 1000000.0 << ","
+            << (s._acquisitions ? s._holdIns / s._acquisitions : 0) << "," << s._condWaits << "," << s._condWaitNs / 1000000.0;
+}
+
+#define LOCKPROF_COLUMNS "Kind,Acquisitions,Contended,FailedTries,WaitInstructions,WaitMs,HoldInstructions,HoldMs,AvgHoldInstructions,CondWaits,CondWaitMs"
+
+VOID LockProf_Fini(INT32 code, VOID *v)
+{
+    // Merge the threads, by lock and by lock and site
+    std::map<ADDRINT, lock_stats_t> locks;
+    std::map<std::pair<ADDRINT, ADDRINT>, lock_stats_t> sites;
+    for (INT32 t = 0; t < numThreads; t++)
+    {
+        lock_thread_t* lt = get_lockprof(t);
+        for (std::map<std::pair<ADDRINT, ADDRINT>, lock_stats_t>::iterator it = lt->_stats.begin(); it != lt->_stats.end(); ++it)
+        {
+            LockProf_Merge(locks[it->first.first], it->second);
+            LockProf_Merge(sites[it->first], it->second);
+        }
+    }
+
+    std::vector< std::pair<ADDRINT, lock_stats_t> > hot(locks.begin(), locks.end());
+    UINT32 topN = std::min((size_t)KnobTopN.Value(), hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + topN, hot.end(), LockProf_Compare);
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    OutFile << "Rank,Lock," << LOCKPROF_COLUMNS << endl;
+    for (UINT32 i = 0; i < topN; i++)
+    {
+        OutFile << i+1 << "," << hexstr(hot[i].first) << ",";
+        LockProf_Columns(hot[i].second);
+        OutFile << endl;
+    }
+
+    // The call sites of those locks
+    OutFile << endl << "Rank,Lock,Site," << LOCKPROF_COLUMNS << "," << SOURCE_LOCATION_HEADER << endl;
+    for (UINT32 i = 0; i < topN; i++)
+    {
+        std::map<std::pair<ADDRINT, ADDRINT>, lock_stats_t>::iterator it = sites.lower_bound(std::make_pair(hot[i].first, (ADDRINT)0));
+        for (; it != sites.end() && it->first.first == hot[i].first; ++it)
+        {
+            OutFile << i+1 << "," << hexstr(it->first.first) << "," << hexstr(it->first.second) << ",";
+            LockProf_Columns(it->second);
+            OutFile << "," << SourceLocation(it->first.second) << endl;
+        }
+    }
+
+    Filter_Report(OutFile);
+    OutFile.close();
+    ReleaseLock(&OutFileLock);
+}
@@ -0,0 +1,131 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_LOCKPROF_H
+#define MEMPIN_LOCKPROF_H
+
+//
+// Tool entry points
+//
+
+BOOL lockprof(INT32 toolId);
+
+// Hooked pthread routines
+#define LOCK_KIND_MUTEX_LOCK 0
+#define LOCK_KIND_MUTEX_TRYLOCK 1
+#define LOCK_KIND_MUTEX_TIMEDLOCK 2
+#define LOCK_KIND_MUTEX_UNLOCK 3
+#define LOCK_KIND_RWLOCK_RDLOCK 4
+#define LOCK_KIND_RWLOCK_WRLOCK 5
+#define LOCK_KIND_RWLOCK_TRYRDLOCK 6
+#define LOCK_KIND_RWLOCK_TRYWRLOCK 7
+#define LOCK_KIND_RWLOCK_TIMEDRDLOCK 8
+#define LOCK_KIND_RWLOCK_TIMEDWRLOCK 9
+#define LOCK_KIND_RWLOCK_UNLOCK 10
+#define LOCK_KIND_COND_WAIT 11
+#define LOCK_KIND_COND_TIMEDWAIT 12
+#define LOCK_KIND_SPIN_LOCK 13
+#define LOCK_KIND_SPIN_TRYLOCK 14
+#define LOCK_KIND_SPIN_UNLOCK 15
+
+// Types of locks
+#define LOCK_TYPE_MUTEX 0
+#define LOCK_TYPE_RWLOCK 1
+#define LOCK_TYPE_SPIN 2
+
+// Nested hooked calls we keep track of
+#define LOCKPROF_MAX_DEPTH 4
+
+// A spin lock that took more instructions than this had to spin
+#define LOCKPROF_SPIN_INSTRUCTIONS 64
+
+// Statistics of one lock acquired at one call site
+typedef struct LockStats
+{
+    UINT32 _type;
+    UINT64 _acquisitions;
+    UINT64 _contended;          // had to wait in the kernel or spin
+    UINT64 _failedTries;
+    UINT64 _waitIns;
+    UINT64 _waitNs;
+    UINT64 _holdIns;
+    UINT64 _holdNs;
+    UINT64 _condWaits;          // condition waits releasing the lock
+    UINT64 _condWaitNs;
+} lock_stats_t;
+
+// Hooked call in flight
+typedef struct LockCall
+{
+    UINT32 _kind;
+    ADDRINT _lock;
+    ADDRINT _mutex;             // of a condition wait
+    ADDRINT _site;              // return address
+    ADDRINT _sp;
+    UINT64 _startIns;
+    UINT64 _startNs;
+    BOOL _futex;                // the call slept in the kernel
+} lock_call_t;
+
+// A lock held by the thread since
+typedef struct LockHold
+{
+    ADDRINT _site;
+    UINT64 _startIns;
+    UINT64 _startNs;
+} lock_hold_t;
+
+// Per-thread state, kept in thread_data_t::_tool
+typedef struct LockThread
+{
+    lock_call_t _calls[LOCKPROF_MAX_DEPTH];
+    UINT32 _depth;
+    std::map<ADDRINT, lock_hold_t> _held;
+    std::map<std::pair<ADDRINT, ADDRINT>, lock_stats_t> _stats;    // by lock and site
+} lock_thread_t;
+
+/** Thread start callback, sets up the per-thread state */
+VOID LockProf_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
+
+/** Hooked routine entry and exit */
+VOID LockProf_Enter(UINT32 kind, ADDRINT arg0, ADDRINT arg1, ADDRINT sp, ADDRINT retIp, THREADID threadid);
+VOID LockProf_Exit(ADDRINT ret, ADDRINT sp, THREADID threadid);
+
+/** Syscall entry callback, spots futex waits */
+VOID LockProf_SyscallEntry(THREADID threadid, CONTEXT *ctxt, SYSCALL_STANDARD std, VOID *v);
+
+/** Image load callback, hooks the pthread routines */
+VOID LockProf_ImageLoad(IMG img, VOID *v);
+
+/** Finish callback */
+VOID LockProf_Fini(INT32 code, VOID *v);
+
+#endif // MEMPIN_LOCKPROF_H
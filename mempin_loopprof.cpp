@@ -0,0 +1,400 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_loopprof.h"
+
+//
+// Tool Registration
+//
+
+BOOL loopprof(INT32 toolId)
+{
+    if ( toolId == TOOL_LOOPPROF )
+    {
+        LOGI("Registering callbacks for loopprof");
+
+        // Per-thread counters of inscount
+        Inscount_Init();
+
+        // Loops have to be known before the blocks get attributed to them
+        PIN_AddThreadStartFunction(Loopprof_ThreadStart, 0);
+        TRACE_AddInstrumentFunction(Loopprof_Trace, 0);
+        TRACE_AddInstrumentFunction(Inscount_Trace, reinterpret_cast<VOID*>(Loopprof_Bbl));
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(Loopprof_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// Loopprof implementation
+//
+// A direct branch to a lower address of the same routine is a back edge
+// and its target the head of a loop. All back edges to the same head
+// make up one loop, which spans from the head to the last of them. Code
+// translated before a loop was found gets instrumented again.
+//
+// Reaching the head right after one of its back edges is the next
+// iteration, reaching it any other way a new entry, which also closes
+// the trip count of the last one. Exits through break or return are
+// covered this way too.
+//
+// Each block counts its instructions, loads, stores and bytes against
+// the innermost loop containing it. Calls out of a loop are not part of
+// it. Outer loops add up their inner loops at Fini.
+
+// All loops seen so far, indexed by id
+static std::vector<loopprof_loop_t> LoopList;
+
+// Id of each loop by its head
+static std::map<ADDRINT, UINT32> LoopIds;
+
+static loopprof_thread_t* get_loopprof(THREADID threadid)
+{
+    return static_cast<loopprof_thread_t*>(get_tls(threadid)->_tool);
+}
+
+VOID Loopprof_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    get_tls(threadid)->_tool = new loopprof_thread_t();
+}
+
+static inline UINT32 Loopprof_TripClass(UINT64 trips)
+{
+    UINT32 c = 0;
+    while ( (trips >>= 1) && c < LOOPPROF_TRIP_CLASSES - 1 )
+        c++;
+    return c;
+}
+
+static inline VOID Loopprof_Head(loopprof_thread_t* lt, UINT32 id)
+{
+    loopprof_stats_t &stats = lt->_loops[id];
+    stats._iterations++;
+    if ( lt->_backEdge == id + 1 )
+        stats._trips++;
+    else
+    {
+        if ( stats._trips )
+            stats._tripClasses[Loopprof_TripClass(stats._trips)]++;
+        stats._entries++;
+        stats._trips = 1;
+    }
+    lt->_backEdge = 0;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL loopprof_head(UINT32 id, THREADID threadid)
+{
+    Loopprof_Head(get_loopprof(threadid), id);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL loopprof_head_reg(UINT32 id, thread_data_t* tdata)
+{
+    Loopprof_Head(static_cast<loopprof_thread_t*>(tdata->_tool), id);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL loopprof_backedge(UINT32 id, THREADID threadid)
+{
+    get_loopprof(threadid)->_backEdge = id + 1;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL loopprof_backedge_reg(UINT32 id, thread_data_t* tdata)
+{
+    static_cast<loopprof_thread_t*>(tdata->_tool)->_backEdge = id + 1;
+}
+
+static inline VOID Loopprof_Body(loopprof_thread_t* lt, UINT32 id, UINT32 numIns, UINT32 loads, UINT32 stores, UINT32 bytes)
+{
+    loopprof_stats_t &stats = lt->_loops[id];
+    stats._instructions += numIns;
+    stats._loads += loads;
+    stats._stores += stores;
+    stats._bytes += bytes;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL loopprof_body(UINT32 id, UINT32 numIns, UINT32 loads, UINT32 stores, UINT32 bytes, THREADID threadid)
+{
+    Loopprof_Body(get_loopprof(threadid), id, numIns, loads, stores, bytes);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL loopprof_body_reg(UINT32 id, UINT32 numIns, UINT32 loads, UINT32 stores, UINT32 bytes, thread_data_t* tdata)
+{
+    Loopprof_Body(static_cast<loopprof_thread_t*>(tdata->_tool), id, numIns, loads, stores, bytes);
+}
+
+// Innermost loop containing the address, the one with the closest head
+static INT32 Loopprof_Find(ADDRINT address)
+{
+    std::map<ADDRINT, UINT32>::iterator it = LoopIds.upper_bound(address);
+    for (UINT32 i = 0; i < LOOPPROF_MAX_SCAN && it != LoopIds.begin(); i++)
+    {
+        --it;
+        if ( address <= LoopList[it->second]._end )
+            return it->second;
+    }
+    return -1;
+}
+
+// Instrumentation runs serialized by Pin, no need to lock the loop list
+VOID Loopprof_Trace(TRACE trace, VOID *v)
+{
+    RTN rtn = TRACE_Rtn(trace);
+
+    // Find the back edges first, the heads may come before them
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        INS tail = BBL_InsTail(bbl);
+        if ( !INS_IsDirectBranch(tail) )
+            continue;
+
+        ADDRINT head = INS_DirectBranchOrCallTargetAddress(tail);
+        ADDRINT end = INS_Address(tail);
+        if ( head > end || (RTN_Valid(rtn) && head < RTN_Address(rtn)) )
+            continue;
+
+        std::map<ADDRINT, UINT32>::iterator it = LoopIds.find(head);
+        if ( it != LoopIds.end() && LoopList[it->second]._end >= end )
+            continue;
+
+        if ( it == LoopIds.end() )
+        {
+            if ( LoopList.size() >= COUNTER_MAX_ID )
+            {
+                WARN("Too many loops, " << hexstr(head) << " will not be profiled");
+                continue;
+            }
+
+            loopprof_loop_t loop;
+            loop._head = head;
+            loop._end = end;
+            LoopIds[head] = LoopList.size();
+            LoopList.push_back(loop);
+            SourceLocation_Record(head);
+        }
+        else
+            LoopList[it->second]._end = end;
+
+        // Code of the loop translated so far knows nothing about it
+        PIN_RemoveInstrumentationInRange(head, end + INS_Size(tail));
+    }
+
+    REG reg = Inscount_ToolReg();
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if ( !Filter_Bbl(bbl) )
+            continue;
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            std::map<ADDRINT, UINT32>::iterator it = LoopIds.find(INS_Address(ins));
+            if ( it == LoopIds.end() )
+                continue;
+
+            if ( REG_valid(reg) )
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)loopprof_head_reg, IARG_FAST_ANALYSIS_CALL,
+                               IARG_UINT32, it->second, IARG_REG_VALUE, reg, IARG_END);
+            else
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)loopprof_head, IARG_FAST_ANALYSIS_CALL,
+                               IARG_UINT32, it->second, IARG_THREAD_ID, IARG_END);
+        }
+
+        INS tail = BBL_InsTail(bbl);
+        if ( !INS_IsDirectBranch(tail) )
+            continue;
+
+        std::map<ADDRINT, UINT32>::iterator it = LoopIds.find(INS_DirectBranchOrCallTargetAddress(tail));
+        if ( it == LoopIds.end() || INS_Address(tail) < it->first || INS_Address(tail) > LoopList[it->second]._end )
+            continue;
+
+        if ( REG_valid(reg) )
+            INS_InsertCall(tail, IPOINT_TAKEN_BRANCH, (AFUNPTR)loopprof_backedge_reg, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, it->second, IARG_REG_VALUE, reg, IARG_END);
+        else
+            INS_InsertCall(tail, IPOINT_TAKEN_BRANCH, (AFUNPTR)loopprof_backedge, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, it->second, IARG_THREAD_ID, IARG_END);
+    }
+}
+
+VOID Loopprof_Bbl(BBL bbl)
+{
+    INT32 id = Loopprof_Find(BBL_Address(bbl));
+    if ( id < 0 )
+        return;
+
+    REG reg = Inscount_ToolReg();
+    UINT32 loads = 0, stores = 0, bytes = 0;
+    for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+    {
+        UINT32 insLoads = 0, insStores = 0, insBytes = 0;
+        for (UINT32 op = 0; op < INS_MemoryOperandCount(ins); op++)
+        {
+            if ( INS_MemoryOperandIsRead(ins, op) )
+                insLoads++;
+            if ( INS_MemoryOperandIsWritten(ins, op) )
+                insStores++;
+            insBytes += INS_MemoryOperandSize(ins, op);
+        }
+
+        if ( !INS_IsPredicated(ins) )
+        {
+            loads += insLoads;
+            stores += insStores;
+            bytes += insBytes;
+            continue;
+        }
+
+        // Predicated instructions only count when they execute, rep
+        // prefixed string instructions once per element
+        if ( !insBytes )
+            continue;
+        if ( REG_valid(reg) )
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)loopprof_body_reg, IARG_FAST_ANALYSIS_CALL,
+                                     IARG_UINT32, id, IARG_UINT32, 0, IARG_UINT32, insLoads, IARG_UINT32, insStores,
+                                     IARG_UINT32, insBytes, IARG_REG_VALUE, reg, IARG_END);
+        else
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)loopprof_body, IARG_FAST_ANALYSIS_CALL,
+                                     IARG_UINT32, id, IARG_UINT32, 0, IARG_UINT32, insLoads, IARG_UINT32, insStores,
+                                     IARG_UINT32, insBytes, IARG_THREAD_ID, IARG_END);
+    }
+
+    if ( REG_valid(reg) )
+        BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)loopprof_body_reg, IARG_FAST_ANALYSIS_CALL,
+                       IARG_UINT32, id, IARG_UINT32, BBL_NumIns(bbl), IARG_UINT32, loads, IARG_UINT32, stores,
+                       IARG_UINT32, bytes, IARG_REG_VALUE, reg, IARG_END);
+    else
+        BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)loopprof_body, IARG_FAST_ANALYSIS_CALL,
+                       IARG_UINT32, id, IARG_UINT32, BBL_NumIns(bbl), IARG_UINT32, loads, IARG_UINT32, stores,
+                       IARG_UINT32, bytes, IARG_THREAD_ID, IARG_END);
+}
+
+// Order loops by dynamic instruction count, highest first
+static bool Loopprof_Compare(const std::pair<UINT64, UINT32> &a, const std::pair<UINT64, UINT32> &b)
+{
+    return a.first > b.first;
+}
+
+static string Loopprof_Histogram(const UINT64 *counts)
+{
+    string histogram;
+    for (UINT32 c = 0; c < LOOPPROF_TRIP_CLASSES; c++)
+    {
+        if ( counts[c] )
+            histogram += decstr(1ULL << c) + ":" + decstr(counts[c]) + " ";
+    }
+    return histogram;
+}
+
+// This function is called when the application exits
+VOID Loopprof_Fini(INT32 code, VOID *v)
+{
+    // Merge the threads, closing the entries still running
+    std::vector<loopprof_stats_t> loops(LoopList.size());
+    UINT64 total = 0;
+    for (INT32 t = 0; t < numThreads; t++)
+    {
+        total += get_tls(t)->_count;
+        loopprof_thread_t* lt = get_loopprof(t);
+        for (UINT32 id = 0; id < LoopList.size(); id++)
+        {
+            const loopprof_stats_t *s = lt->_loops.find(id);
+            if ( !s )
+                continue;
+
+            loopprof_stats_t &l = loops[id];
+            l._entries += s->_entries;
+            l._iterations += s->_iterations;
+            l._instructions += s->_instructions;
+            l._loads += s->_loads;
+            l._stores += s->_stores;
+            l._bytes += s->_bytes;
+            for (UINT32 c = 0; c < LOOPPROF_TRIP_CLASSES; c++)
+                l._tripClasses[c] += s->_tripClasses[c];
+            if ( s->_trips )
+                l._tripClasses[Loopprof_TripClass(s->_trips)]++;
+        }
+    }
+
+    // Outer loops include their inner loops. Heads come in address order,
+    // so the enclosing loops of each one are still on the stack.
+    std::vector<loopprof_stats_t> inclusive(loops);
+    std::vector<UINT32> depth(LoopList.size(), 0);
+    std::vector<UINT32> outer;
+    for (std::map<ADDRINT, UINT32>::iterator it = LoopIds.begin(); it != LoopIds.end(); ++it)
+    {
+        UINT32 id = it->second;
+        while ( !outer.empty() && LoopList[outer.back()]._end < LoopList[id]._end )
+            outer.pop_back();
+
+        depth[id] = outer.size();
+        for (UINT32 o = 0; o < outer.size(); o++)
+        {
+            inclusive[outer[o]]._instructions += loops[id]._instructions;
+            inclusive[outer[o]]._loads += loops[id]._loads;
+            inclusive[outer[o]]._stores += loops[id]._stores;
+            inclusive[outer[o]]._bytes += loops[id]._bytes;
+        }
+        outer.push_back(id);
+    }
+
+    std::vector< std::pair<UINT64, UINT32> > hot;
+    for (UINT32 id = 0; id < LoopList.size(); id++)
+    {
+        if ( loops[id]._iterations )
+            hot.push_back(std::make_pair(inclusive[id]._instructions, id));
+    }
+    UINT32 topN = std::min((size_t)KnobTopN.Value(), hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + topN, hot.end(), Loopprof_Compare);
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    OutFile << "Rank,Head,End,Depth,Entries,Iterations,AvgTrips,TripClasses,Instructions,Share,"
+            << "InstructionsPerIteration,LoadsPerIteration,StoresPerIteration,BytesPerIteration," << SOURCE_LOCATION_HEADER << endl;
+    for (UINT32 i = 0; i < topN; i++)
+    {
+        UINT32 id = hot[i].second;
+        loopprof_stats_t &l = loops[id];
+        loopprof_stats_t &inc = inclusive[id];
+        double iterations = (double)l._iterations;
+
+        OutFile << i+1 << "," << hexstr(LoopList[id]._head) << "," << hexstr(LoopList[id]._end) << "," << depth[id] << ","
+                << l._entries << "," << l._iterations << "," << (l._entries ? iterations / l._entries : 0) << ","
+                << Loopprof_Histogram(l._tripClasses) << "," << inc._instructions << ","
+                << (total ? 100.0 * inc._instructions / total : 0) << "," << inc._instructions / iterations << ","
+                << inc._loads / iterations << "," << inc._stores / iterations << "," << inc._bytes / iterations << ","
+                << SourceLocation(LoopList[id]._head) << endl;
+    }
+
+    Filter_Report(OutFile);
+    OutFile.close();
+    ReleaseLock(&OutFileLock);
+}
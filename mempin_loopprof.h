@@ -0,0 +1,88 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_LOOPPROF_H
+#define MEMPIN_LOOPPROF_H
+
+//
+// Tool entry points
+//
+
+BOOL loopprof(INT32 toolId);
+
+// Trip count classes, powers of two
+#define LOOPPROF_TRIP_CLASSES 24
+
+// Loops checked when looking for the innermost loop of a block
+#define LOOPPROF_MAX_SCAN 64
+
+// A loop as seen at instrumentation time, from its head to the last
+// backward branch to it
+typedef struct LoopprofLoop
+{
+    ADDRINT _head;
+    ADDRINT _end;
+} loopprof_loop_t;
+
+// Counters of one loop in one thread, the body counters only cover
+// blocks of no inner loop
+typedef struct LoopprofStats
+{
+    UINT64 _entries;
+    UINT64 _iterations;
+    UINT64 _trips;              // iterations of the current entry
+    UINT64 _tripClasses[LOOPPROF_TRIP_CLASSES];
+    UINT64 _instructions;
+    UINT64 _loads;
+    UINT64 _stores;
+    UINT64 _bytes;
+} loopprof_stats_t;
+
+// Per-thread state, kept in thread_data_t::_tool
+typedef struct LoopprofThread
+{
+    UINT32 _backEdge;           // loop id + 1 of the back edge just taken
+    chunked_table_t<loopprof_stats_t> _loops;
+} loopprof_thread_t;
+
+/** Thread start callback, sets up the loop counters */
+VOID Loopprof_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
+
+/** Trace instrumentation, finds loops and hooks heads and back edges */
+VOID Loopprof_Trace(TRACE trace, VOID *v);
+
+/** Per BBL instrumentation, hooked into Inscount_Trace */
+VOID Loopprof_Bbl(BBL bbl);
+
+/** Finish callback */
+VOID Loopprof_Fini(INT32 code, VOID *v);
+
+#endif // MEMPIN_LOOPPROF_H
@@ -32,6 +32,27 @@
 #include "mempin.h"
 #include "mempin_malloctrace.h"
 
+KNOB<BOOL> KnobMallocTrace(KNOB_MODE_WRITEONCE, "pintool",
+    "malloc_trace", "1", "write every heap event of malloctrace, 0 only writes the summary.");
+
+KNOB<UINT32> KnobMallocDepth(KNOB_MODE_WRITEONCE, "pintool",
+    "malloc_depth", "0", "call stack depth identifying an allocation site, 0 disables allocation site profiling.");
+
+KNOB<BOOL> KnobMallocLifetime(KNOB_MODE_WRITEONCE, "pintool",
+    "malloc_lifetime", "0", "measure the lifetime of heap blocks in instructions of the allocating thread.");
+
+KNOB<UINT64> KnobMallocShortLived(KNOB_MODE_WRITEONCE, "pintool",
+    "malloc_short", "10000", "blocks freed within this many instructions count as short-lived.");
+
+KNOB<BOOL> KnobMallocRemote(KNOB_MODE_WRITEONCE, "pintool",
+    "malloc_remote", "0", "report frees from another thread by allocation site and thread pair.");
+
+KNOB<UINT32> KnobMallocRingSize(KNOB_MODE_WRITEONCE, "pintool",
+    "malloc_ring", "65536", "number of records in the per-thread malloctrace buffer, rounded up to a power of two.");
+
+KNOB<string> KnobMallocFullPolicy(KNOB_MODE_WRITEONCE, "pintool",
+    "malloc_full", "block", "what a thread does when its malloctrace buffer is full: block or drop.");
+
 //
 // Tool Registration
 //
@@ -42,12 +63,15 @@ BOOL malloctrace(INT32 toolId)
     {
     	LOGI("Registering callbacks for malloctrace");
 
-    	// Register ImageLoad to be called when each image is loaded.
-    	IMG_AddInstrumentFunction(MallocTrace_ImageLoad, 0);
+        // Lifetimes are measured with the instruction counters of inscount
+        if ( KnobMallocLifetime.Value() )
+        {
+            Inscount_Init();
+            TRACE_AddInstrumentFunction(Inscount_Trace, 0);
+        }
 
-    	// Register Analysis routines to be called when a thread begins/ends
-	    PIN_AddThreadStartFunction(MallocTrace_ThreadStart, 0);
-	    PIN_AddThreadFiniFunction(MallocTrace_ThreadFini, 0);
+        // Heap hooks, live block table and the background writer
+        MallocTrace_Register(KnobMallocTrace.Value(), KnobMallocLifetime.Value(), 0, 0);
 
 	    // Register Fini to be called when the application exits
 	    PIN_AddFiniFunction(MallocTrace_Fini, 0);
@@ -60,59 +84,854 @@ BOOL malloctrace(INT32 toolId)
 //
 // Malloc Trace implemention
 //
-// Note that opening a file in a callback is only supported on Linux systems.
+// Traced threads never touch the output file. Each one appends fixed size
+// records to its own lock-free ring and an internal writer thread drains
+// all rings to disk in the background. When a ring is full the thread
+// either waits for the writer (block) or drops the record (drop).
+//
+// Besides the trace the live blocks are kept in a sharded table keyed by
+// address, which gives the current and peak heap footprint and the leaks.
 
-VOID MallocTrace_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+// Symbols of the heap entry points
+typedef struct MallocHook
+{
+    const char * _name;
+    UINT32 _kind;
+} malloc_hook_t;
+
+static const malloc_hook_t MallocHooks[] =
+{
+    { MALLOC, MALLOC_KIND_MALLOC },
+    { "calloc", MALLOC_KIND_CALLOC },
+    { "realloc", MALLOC_KIND_REALLOC },
+    { "memalign", MALLOC_KIND_MEMALIGN },
+    { "aligned_alloc", MALLOC_KIND_MEMALIGN },
+    { "posix_memalign", MALLOC_KIND_POSIX_MEMALIGN },
+    { "valloc", MALLOC_KIND_VALLOC },
+    { "pvalloc", MALLOC_KIND_VALLOC },
+    { "_Znwm", MALLOC_KIND_NEW },               // operator new(unsigned long)
+    { "_Znam", MALLOC_KIND_NEW },               // operator new[](unsigned long)
+    { "_Znwj", MALLOC_KIND_NEW },               // operator new(unsigned int)
+    { "_Znaj", MALLOC_KIND_NEW },               // operator new[](unsigned int)
+    { "_ZnwmRKSt9nothrow_t", MALLOC_KIND_NEW },
+    { "_ZnamRKSt9nothrow_t", MALLOC_KIND_NEW },
+    { FREE, MALLOC_KIND_FREE },
+    { "cfree", MALLOC_KIND_FREE },
+    { "_ZdlPv", MALLOC_KIND_DELETE },           // operator delete(void*)
+    { "_ZdaPv", MALLOC_KIND_DELETE },           // operator delete[](void*)
+    { "_ZdlPvm", MALLOC_KIND_DELETE },          // sized delete
+    { "_ZdaPvm", MALLOC_KIND_DELETE },
+    { "_ZdlPvj", MALLOC_KIND_DELETE },
+    { "_ZdaPvj", MALLOC_KIND_DELETE },
+};
+
+static const char * MallocKindNames[MALLOC_KIND_NUM] =
+{
+    "malloc", "calloc", "realloc", "memalign", "posix_memalign", "valloc", "new", "free", "delete"
+};
+
+// Per-thread state by thread id, NumThreads is one past the highest id seen
+static malloc_thread_t * Threads[MALLOCTRACE_MAX_THREADS];
+static volatile INT32 NumThreads = 0;
+
+static UINT64 RingSize = 0;
+static BOOL DropWhenFull = FALSE;
+
+static volatile BOOL WriterStop = FALSE;
+static PIN_THREAD_UID WriterUid;
+
+// Live blocks
+static malloc_shard_t Shards[MALLOCTRACE_SHARDS];
+
+// Allocation sites by id and by hash. Threads only come here the first
+// time they see a site, after that their own _siteIds knows it.
+static std::vector<malloc_site_t *> Sites;
+static std::map<UINT64, UINT32> SiteIds;
+static PIN_LOCK SiteLock;
+static UINT32 SiteDepth = 0;
+
+// Per-site statistics are needed for sites and for lifetimes
+static BOOL SiteStats = FALSE;
+static BOOL Lifetimes = FALSE;
+static BOOL RemoteFrees = FALSE;
+
+// Write the trace, and the hooks of a tool built on top of us
+static BOOL Tracing = FALSE;
+static malloc_alloc_hook AllocHook = 0;
+static malloc_free_hook FreeHook = 0;
+
+// Heap footprint. The current size is shared by all threads, one atomic
+// add per event is the price for knowing the peak.
+static volatile UINT64 HeapCurrent = 0;
+static UINT64 HeapPeak = 0;
+static THREADID HeapPeakThread = 0;
+static UINT64 HeapPeakAllocs = 0;       // allocations of that thread so far
+static UINT64 HeapPeakTime = 0;         // ms since start
+static UINT64 HeapStart = 0;
+static PIN_LOCK HeapPeakLock;
+
+static malloc_shard_t* MallocTrace_Shard(ADDRINT address)
+{
+    // Blocks are at least 16 byte aligned, mix the remaining bits
+    return &Shards[((address >> 4) * 0x9E3779B97F4A7C15ULL >> 32) % MALLOCTRACE_SHARDS];
+}
+
+// Append a record to the ring of the thread
+static VOID MallocTrace_Push(THREADID threadid, UINT32 type, UINT32 kind, UINT64 arg0, UINT64 arg1)
+{
+    if ( !Tracing )
+        return;
+
+    malloc_ring_t *ring = &Threads[threadid]->_ring;
+    UINT64 head = ring->_head;
+    while ( head - ring->_tail > ring->_mask )
+    {
+        // Nobody will make room once the writer is gone
+        if ( DropWhenFull || WriterStop )
+        {
+            ring->_dropped++;
+            return;
+        }
+        PIN_Yield();
+    }
+
+    malloc_record_t *record = &ring->_records[head & ring->_mask];
+    record->_type = type;
+    record->_tid = threadid;
+    record->_kind = kind;
+    record->_arg0 = arg0;
+    record->_arg1 = arg1;
+
+    // The record has to be visible before the writer sees the new head
+    __sync_synchronize();
+    ring->_head = head + 1;
+}
+
+// Format a record into the output file, the drain flushes once per pass
+static VOID MallocTrace_Write(const malloc_record_t *record)
+{
+    switch (record->_type)
+    {
+        case MALLOC_EVENT_THREAD_BEGIN:
+            OutFile << "thread begin " << record->_tid << '\n';
+            break;
+        case MALLOC_EVENT_THREAD_END:
+            OutFile << "thread " << record->_tid << " end code(" << (INT32)record->_arg0 << ")" << '\n';
+            break;
+        case MALLOC_EVENT_ALLOC:
+            OutFile << "thread " << record->_tid << " " << MallocKindNames[record->_kind]
+                    << "(" << record->_arg1 << ") ret(" << hexstr(record->_arg0) << ")" << '\n';
+            break;
+        case MALLOC_EVENT_FREE:
+            OutFile << "thread " << record->_tid << " " << MallocKindNames[record->_kind]
+                    << "(" << hexstr(record->_arg0) << ") size(" << record->_arg1 << ")" << '\n';
+            break;
+    }
+}
+
+// Write out everything the rings hold right now, returns the number of records
+static UINT64 MallocTrace_Drain()
 {
-    GetLock(&OutFileLock, threadid+1);
-    OutFile << "thread begin " << threadid << endl;
+    UINT64 drained = 0;
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    for (INT32 t = 0; t < NumThreads; t++)
+    {
+        if ( !Threads[t] )
+            continue;
+        malloc_ring_t *ring = &Threads[t]->_ring;
+
+        UINT64 head = ring->_head;
+        __sync_synchronize();
+        for (UINT64 tail = ring->_tail; tail != head; tail++)
+            MallocTrace_Write(&ring->_records[tail & ring->_mask]);
+
+        drained += head - ring->_tail;
+
+        // Done reading the records before handing the slots back
+        __sync_synchronize();
+        ring->_tail = head;
+    }
+    if ( drained )
+        OutFile.flush();
     ReleaseLock(&OutFileLock);
+
+    return drained;
+}
+
+// Internal writer thread
+static VOID MallocTrace_Writer(VOID *arg)
+{
+    while ( !WriterStop )
+    {
+        if ( MallocTrace_Drain() == 0 )
+            PIN_Sleep(1);
+    }
+    PIN_ExitThread(0);
+}
+
+// Live block table and the background writer draining the per-thread buffers
+static VOID MallocTrace_Init()
+{
+    for (UINT32 i = 0; i < MALLOCTRACE_SHARDS; i++)
+        InitLock(&Shards[i]._lock);
+    InitLock(&HeapPeakLock);
+    HeapStart = GetTimeMs();
+
+    // A tool on top of us reports by site, at least tell the callers apart
+    SiteDepth = std::min(KnobMallocDepth.Value(), (UINT32)MALLOCTRACE_MAX_FRAMES);
+    if ( AllocHook && !SiteDepth )
+        SiteDepth = 1;
+
+    // Site 0 is the unknown site
+    InitLock(&SiteLock);
+    Sites.push_back(new malloc_site_t());
+    RemoteFrees = KnobMallocRemote.Value();
+    SiteStats = SiteDepth || Lifetimes || RemoteFrees;
+
+    RingSize = 1;
+    while ( Tracing && RingSize < KnobMallocRingSize.Value() )
+        RingSize <<= 1;
+    DropWhenFull = KnobMallocFullPolicy.Value() == "drop";
+
+    if ( Tracing
+         && PIN_SpawnInternalThread(MallocTrace_Writer, 0, 0, &WriterUid) == INVALID_THREADID )
+    {
+        ERROR("Failed to start the malloctrace writer thread");
+    }
+}
+
+VOID MallocTrace_Register(BOOL trace, BOOL lifetimes, malloc_alloc_hook onAlloc, malloc_free_hook onFree)
+{
+    Tracing = trace;
+    Lifetimes = lifetimes;
+    AllocHook = onAlloc;
+    FreeHook = onFree;
+
+    // Register ImageLoad to be called when each image is loaded.
+    IMG_AddInstrumentFunction(MallocTrace_ImageLoad, 0);
+
+    // Register Analysis routines to be called when a thread begins/ends
+    PIN_AddThreadStartFunction(MallocTrace_ThreadStart, 0);
+    PIN_AddThreadFiniFunction(MallocTrace_ThreadFini, 0);
+
+    MallocTrace_Init();
+    PIN_AddPrepareForFiniFunction(MallocTrace_PrepareForFini, 0);
+}
+
+VOID MallocTrace_PrepareForFini(VOID *v)
+{
+    if ( !Tracing )
+        return;
+
+    WriterStop = TRUE;
+    PIN_WaitForThreadTermination(WriterUid, PIN_INFINITE_TIMEOUT, 0);
+}
+
+VOID MallocTrace_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    if ( threadid >= MALLOCTRACE_MAX_THREADS )
+    {
+        WARN("Thread " << threadid << " will not be traced");
+        return;
+    }
+
+    // Thread ids get reused, so does the state of a finished thread
+    if ( !Threads[threadid] )
+    {
+        malloc_thread_t *mt = new malloc_thread_t();
+        mt->_ring._mask = RingSize - 1;
+        mt->_ring._records = new malloc_record_t[RingSize];
+
+        Threads[threadid] = mt;
+        __sync_synchronize();
+
+        // Threads start concurrently, only ever raise the count
+        INT32 count = NumThreads;
+        while ( (INT32)threadid >= count && !__sync_bool_compare_and_swap(&NumThreads, count, threadid + 1) )
+            count = NumThreads;
+    }
+    Threads[threadid]->_depth = 0;
+
+    MallocTrace_Push(threadid, MALLOC_EVENT_THREAD_BEGIN, 0, 0, 0);
 }
 
 VOID MallocTrace_ThreadFini(THREADID threadid, const CONTEXT *ctxt, INT32 code, VOID *v)
 {
-    GetLock(&OutFileLock, threadid+1);
-    OutFile << "thread " << threadid << " end code(" << code << ")" << endl;
-    ReleaseLock(&OutFileLock);
+    if ( threadid >= MALLOCTRACE_MAX_THREADS )
+        return;
+
+    MallocTrace_Push(threadid, MALLOC_EVENT_THREAD_END, 0, code, 0);
 }
 
-VOID MallocTrace_BeforeMalloc( int size, THREADID threadid )
+// Power of two size class, class n holds sizes in [2^n, 2^(n+1))
+static UINT32 MallocTrace_SizeClass(ADDRINT size)
 {
-    GetLock(&OutFileLock, threadid+1);
-    OutFile << "thread " << threadid << " entered malloc(" << size << ")" << endl;
-    ReleaseLock(&OutFileLock);
+    if ( size == 0 )
+        return 0;
+    UINT32 sizeClass = 63 - __builtin_clzll((UINT64)size);
+    return std::min(sizeClass, (UINT32)MALLOCTRACE_SIZE_CLASSES - 1);
 }
 
-VOID MallocTrace_AfterMalloc(ADDRINT ret, THREADID threadid)
+// Routine and source line of a frame
+static string MallocTrace_Frame(ADDRINT address)
 {
-    GetLock(&OutFileLock, threadid+1);
-    OutFile << "thread " << threadid << " after malloc ret(" << ret << ")" << endl;
-    ReleaseLock(&OutFileLock);
+    INT32 column = 0;
+    INT32 line = 0;
+    string file;
+
+    PIN_LockClient();
+    string name = RTN_FindNameByAddress(address);
+    PIN_GetSourceLocation(address, &column, &line, &file);
+    PIN_UnlockClient();
+
+    if ( name.empty() )
+        name = hexstr(address);
+    if ( !file.empty() )
+        name += string(" ") + StripPath(file.c_str()) + ":" + decstr(line);
+    return name;
 }
 
-VOID MallocTrace_ImageLoad(IMG img, VOID *)
+// Id of the site with the given call stack, frames[0] is the caller of
+// the heap routine
+static UINT32 MallocTrace_Site(malloc_thread_t *mt, THREADID threadid, const ADDRINT *frames, UINT32 depth)
+{
+    // FNV-1a over the return addresses
+    UINT64 hash = 14695981039346656037ULL;
+    for (UINT32 i = 0; i < depth; i++)
+        hash = (hash ^ frames[i]) * 1099511628211ULL;
+
+    std::map<UINT64, UINT32>::iterator it = mt->_siteIds.find(hash);
+    if ( it != mt->_siteIds.end() )
+        return it->second;
+
+    GetLock(&SiteLock, threadid+1);
+    UINT32 &id = SiteIds[hash];
+    if ( id == 0 )
+    {
+        malloc_site_t *site = new malloc_site_t();
+        site->_hash = hash;
+        site->_depth = depth;
+        memcpy(site->_frames, frames, depth * sizeof(ADDRINT));
+        for (UINT32 f = 0; f < depth; f++)
+            site->_stack += (f ? " <- " : "") + MallocTrace_Frame(frames[f]);
+        id = Sites.size();
+        Sites.push_back(site);
+    }
+    UINT32 siteId = id;
+    ReleaseLock(&SiteLock);
+
+    mt->_siteIds[hash] = siteId;
+    return siteId;
+}
+
+// A new block got allocated
+static VOID MallocTrace_Alloc(THREADID threadid, UINT32 kind, ADDRINT address, ADDRINT size, UINT32 site)
+{
+    malloc_thread_t *mt = Threads[threadid];
+    mt->_allocs++;
+    mt->_allocBytes += size;
+
+    if ( SiteStats )
+    {
+        malloc_site_stats_t &stats = mt->_sites[site];
+        stats._allocs++;
+        stats._bytes += size;
+        stats._sizes[MallocTrace_SizeClass(size)]++;
+    }
+
+    malloc_block_t block;
+    block._size = size;
+    block._tid = threadid;
+    block._site = site;
+    block._time = Lifetimes ? get_tls(threadid)->_count : 0;
+
+    malloc_shard_t *shard = MallocTrace_Shard(address);
+    GetLock(&shard->_lock, threadid+1);
+    shard->_blocks[address] = block;
+    ReleaseLock(&shard->_lock);
+
+    if ( AllocHook )
+        AllocHook(threadid, address, size, site);
+
+    UINT64 current = __sync_add_and_fetch(&mt->_current, size);
+    if ( current > mt->_peak )
+        mt->_peak = current;
+
+    current = __sync_add_and_fetch(&HeapCurrent, size);
+    if ( current > HeapPeak )
+    {
+        GetLock(&HeapPeakLock, threadid+1);
+        if ( current > HeapPeak )
+        {
+            HeapPeak = current;
+            HeapPeakThread = threadid;
+            HeapPeakAllocs = mt->_allocs;
+            HeapPeakTime = GetTimeMs() - HeapStart;
+        }
+        ReleaseLock(&HeapPeakLock);
+    }
+
+    MallocTrace_Push(threadid, MALLOC_EVENT_ALLOC, kind, address, size);
+}
+
+// A block is about to be freed, sets size and returns TRUE if it was known
+static BOOL MallocTrace_Free(THREADID threadid, UINT32 kind, ADDRINT address, ADDRINT *size)
+{
+    malloc_thread_t *mt = Threads[threadid];
+    malloc_block_t block;
+    BOOL found = FALSE;
+
+    malloc_shard_t *shard = MallocTrace_Shard(address);
+    GetLock(&shard->_lock, threadid+1);
+    std::map<ADDRINT, malloc_block_t>::iterator it = shard->_blocks.find(address);
+    if ( it != shard->_blocks.end() )
+    {
+        block = it->second;
+        shard->_blocks.erase(it);
+        found = TRUE;
+    }
+    ReleaseLock(&shard->_lock);
+
+    mt->_frees++;
+    if ( found && FreeHook )
+        FreeHook(threadid, address);
+    if ( !found )
+    {
+        mt->_unknownFrees++;
+        *size = 0;
+        MallocTrace_Push(threadid, MALLOC_EVENT_FREE, kind, address, 0);
+        return FALSE;
+    }
+
+    *size = block._size;
+    mt->_freeBytes += block._size;
+
+    // Per-thread cache allocators pay for blocks handed back to the cache
+    // of another thread
+    if ( block._tid != threadid )
+    {
+        mt->_remoteFrees++;
+        if ( RemoteFrees )
+        {
+            mt->_sites[block._site]._remoteFrees++;
+            mt->_producers[block._tid]++;
+        }
+    }
+
+    // The lifetime is measured on the clock of the allocating thread. A
+    // reused thread id restarts that clock, such lifetimes are unknown.
+    if ( Lifetimes )
+    {
+        UINT64 now = get_tls(block._tid)->_count;
+        if ( now >= block._time )
+        {
+            UINT64 lifetime = now - block._time;
+            malloc_site_stats_t &stats = mt->_sites[block._site];
+            stats._freed++;
+            stats._lifetime += lifetime;
+            stats._shortLived += lifetime < KnobMallocShortLived.Value();
+            stats._lifetimes[MallocTrace_SizeClass(lifetime)]++;
+        }
+    }
+    if ( block._tid < MALLOCTRACE_MAX_THREADS && Threads[block._tid] )
+        __sync_sub_and_fetch(&Threads[block._tid]->_current, block._size);
+    __sync_sub_and_fetch(&HeapCurrent, block._size);
+
+    MallocTrace_Push(threadid, MALLOC_EVENT_FREE, kind, address, block._size);
+    return TRUE;
+}
+
+// Remember the entry of a heap routine, returns the call if it is the
+// outermost one
+static malloc_call_t* MallocTrace_PushCall(THREADID threadid, UINT32 kind, ADDRINT arg0, ADDRINT arg1, ADDRINT arg2, ADDRINT sp, ADDRINT retIp)
+{
+    if ( threadid >= MALLOCTRACE_MAX_THREADS )
+        return 0;
+
+    // Drop the frames a throw or longjmp left behind. A live outer frame
+    // has a higher stack pointer than a new call, a tail call like delete
+    // jumping to free has the same one and the same return address.
+    malloc_thread_t *mt = Threads[threadid];
+    while ( mt->_depth > 0 )
+    {
+        malloc_call_t *top = &mt->_calls[mt->_depth - 1];
+        if ( top->_sp > sp || (top->_sp == sp && top->_retIp == retIp) )
+            break;
+        mt->_depth--;
+    }
+
+    if ( mt->_depth == MALLOCTRACE_MAX_DEPTH )
+        return 0;
+
+    malloc_call_t *call = &mt->_calls[mt->_depth++];
+    call->_kind = kind;
+    call->_arg0 = arg0;
+    call->_arg1 = arg1;
+    call->_arg2 = arg2;
+    call->_sp = sp;
+    call->_retIp = retIp;
+    call->_oldKnown = FALSE;
+    call->_site = 0;
+
+    // Nested calls are part of the outer one
+    return mt->_depth == 1 ? call : 0;
+}
+
+// Handle the entry of the outermost heap routine. Frees are handled right
+// away, before another thread can get the same address back from the
+// allocator.
+static VOID MallocTrace_Begin(THREADID threadid, malloc_call_t *call)
+{
+    UINT32 kind = call->_kind;
+    ADDRINT arg0 = call->_arg0;
+
+    if ( (kind == MALLOC_KIND_FREE || kind == MALLOC_KIND_DELETE) && arg0 )
+        MallocTrace_Free(threadid, kind, arg0, &call->_oldSize);
+    else if ( kind == MALLOC_KIND_REALLOC && arg0 )
+        call->_oldKnown = MallocTrace_Free(threadid, kind, arg0, &call->_oldSize);
+}
+
+// Entry of a heap routine, the site is the caller
+VOID MallocTrace_Enter(UINT32 kind, ADDRINT arg0, ADDRINT arg1, ADDRINT arg2, ADDRINT sp, ADDRINT retIp, THREADID threadid)
+{
+    malloc_call_t *call = MallocTrace_PushCall(threadid, kind, arg0, arg1, arg2, sp, retIp);
+    if ( !call )
+        return;
+
+    if ( SiteDepth )
+        call->_site = MallocTrace_Site(Threads[threadid], threadid, &retIp, 1);
+    MallocTrace_Begin(threadid, call);
+}
+
+// Entry of an allocating heap routine, the site is the call stack
+VOID MallocTrace_EnterStack(UINT32 kind, ADDRINT arg0, ADDRINT arg1, ADDRINT arg2, ADDRINT sp, ADDRINT retIp, const CONTEXT *ctxt, THREADID threadid)
+{
+    malloc_call_t *call = MallocTrace_PushCall(threadid, kind, arg0, arg1, arg2, sp, retIp);
+    if ( !call )
+        return;
+
+    // The first frame is the heap routine itself
+    VOID *frames[MALLOCTRACE_MAX_FRAMES + 1];
+    INT32 depth = PIN_Backtrace(ctxt, frames, SiteDepth + 1);
+
+    ADDRINT stack[MALLOCTRACE_MAX_FRAMES];
+    for (INT32 i = 1; i < depth; i++)
+        stack[i - 1] = (ADDRINT)frames[i];
+
+    call->_site = MallocTrace_Site(Threads[threadid], threadid, stack, depth > 1 ? depth - 1 : 0);
+    MallocTrace_Begin(threadid, call);
+}
+
+// The outermost heap routine returned
+static VOID MallocTrace_Complete(THREADID threadid, malloc_call_t *call, ADDRINT ret)
+{
+    ADDRINT address = ret;
+    ADDRINT size = 0;
+
+    switch (call->_kind)
+    {
+        case MALLOC_KIND_MALLOC:
+        case MALLOC_KIND_VALLOC:
+        case MALLOC_KIND_NEW:
+            size = call->_arg0;
+            break;
+        case MALLOC_KIND_CALLOC:
+            size = call->_arg0 * call->_arg1;
+            break;
+        case MALLOC_KIND_MEMALIGN:
+            size = call->_arg1;
+            break;
+        case MALLOC_KIND_POSIX_MEMALIGN:
+            // Returns 0 on success and the block through memptr
+            address = 0;
+            if ( ret == 0 )
+                PIN_SafeCopy(&address, (VOID *)call->_arg0, sizeof(address));
+            size = call->_arg2;
+            break;
+        case MALLOC_KIND_REALLOC:
+            size = call->_arg1;
+            // A failed realloc keeps the old block, realloc(p, 0) frees it
+            if ( !ret && call->_arg0 && size && call->_oldKnown )
+                MallocTrace_Alloc(threadid, MALLOC_KIND_REALLOC, call->_arg0, call->_oldSize, call->_site);
+            break;
+        default:
+            return;
+    }
+
+    if ( address )
+        MallocTrace_Alloc(threadid, call->_kind, address, size, call->_site);
+}
+
+// Return of a heap routine. Frames are matched by stack pointer, which
+// also copes with tail calls like delete jumping to free.
+VOID MallocTrace_Exit(ADDRINT ret, ADDRINT sp, THREADID threadid)
 {
-	RTN rtn = RTN_FindByName(img, "malloc");
+    if ( threadid >= MALLOCTRACE_MAX_THREADS )
+        return;
+
+    malloc_thread_t *mt = Threads[threadid];
+    while ( mt->_depth > 0 && mt->_calls[mt->_depth - 1]._sp <= sp )
+    {
+        mt->_depth--;
+        if ( mt->_depth == 0 )
+            MallocTrace_Complete(threadid, &mt->_calls[0], ret);
+    }
+}
 
-    if ( RTN_Valid( rtn ))
+VOID MallocTrace_ImageLoad(IMG img, VOID *)
+{
+    for (UINT32 i = 0; i < sizeof(MallocHooks) / sizeof(MallocHooks[0]); i++)
     {
+        RTN rtn = RTN_FindByName(img, MallocHooks[i]._name);
+        if ( !RTN_Valid( rtn ))
+            continue;
+
         RTN_Open(rtn);
-        
-        RTN_InsertCall(rtn, IPOINT_BEFORE, AFUNPTR(MallocTrace_BeforeMalloc),
-			IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
-			IARG_THREAD_ID, IARG_END);
-		RTN_InsertCall(rtn, IPOINT_AFTER, AFUNPTR(MallocTrace_AfterMalloc),
-			IARG_FUNCRET_EXITPOINT_VALUE,
-			IARG_THREAD_ID, IARG_END);
+
+        // Deeper sites need the context to walk the stack, which is only
+        // worth it for the allocating routines
+        UINT32 kind = MallocHooks[i]._kind;
+        BOOL allocates = kind != MALLOC_KIND_FREE && kind != MALLOC_KIND_DELETE;
+        if ( SiteDepth > 1 && allocates )
+            RTN_InsertCall(rtn, IPOINT_BEFORE, AFUNPTR(MallocTrace_EnterStack),
+                IARG_UINT32, kind,
+                IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+                IARG_FUNCARG_ENTRYPOINT_VALUE, 2,
+                IARG_REG_VALUE, REG_STACK_PTR,
+                IARG_RETURN_IP,
+                IARG_CONST_CONTEXT,
+                IARG_THREAD_ID, IARG_END);
+        else
+            RTN_InsertCall(rtn, IPOINT_BEFORE, AFUNPTR(MallocTrace_Enter),
+                IARG_UINT32, kind,
+                IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+                IARG_FUNCARG_ENTRYPOINT_VALUE, 2,
+                IARG_REG_VALUE, REG_STACK_PTR,
+                IARG_RETURN_IP,
+                IARG_THREAD_ID, IARG_END);
+        RTN_InsertCall(rtn, IPOINT_AFTER, AFUNPTR(MallocTrace_Exit),
+            IARG_FUNCRET_EXITPOINT_VALUE,
+            IARG_REG_VALUE, REG_STACK_PTR,
+            IARG_THREAD_ID, IARG_END);
 
         RTN_Close(rtn);
     }
 }
 
+static bool MallocTrace_CompareSites(const std::pair<UINT64, UINT32> &a, const std::pair<UINT64, UINT32> &b)
+{
+    return a.first > b.first;
+}
+
+// Frames of a site as one CSV column
+string MallocTrace_SiteStack(UINT32 id)
+{
+    if ( id == 0 )
+        return "\"[all sites]\"";
+
+    return "\"" + Sites[id]->_stack + "\"";
+}
+
+UINT64 MallocTrace_SiteHash(UINT32 id)
+{
+    return Sites[id]->_hash;
+}
+
+// Power of two histogram as "class:count" pairs
+static string MallocTrace_Histogram(const UINT64 *counts, UINT32 classes)
+{
+    string histogram;
+    for (UINT32 c = 0; c < classes; c++)
+    {
+        if ( counts[c] )
+            histogram += decstr(1ULL << c) + ":" + decstr(counts[c]) + " ";
+    }
+    return histogram;
+}
+
+// Top -topn sites by the given key
+static std::vector< std::pair<UINT64, UINT32> > MallocTrace_TopSites(const std::vector<UINT64> &key)
+{
+    std::vector< std::pair<UINT64, UINT32> > hot;
+    for (UINT32 id = 0; id < key.size(); id++)
+    {
+        if ( key[id] )
+            hot.push_back(std::make_pair(key[id], id));
+    }
+    UINT32 topN = std::min((size_t)KnobTopN.Value(), hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + topN, hot.end(), MallocTrace_CompareSites);
+    hot.resize(topN);
+    return hot;
+}
+
+// Allocation site, lifetime and survivor reports, called with the output
+// file locked
+static VOID MallocTrace_SiteReport()
+{
+    // Merge the per-thread statistics
+    std::vector<malloc_site_stats_t> stats(Sites.size());
+    for (INT32 t = 0; t < NumThreads; t++)
+    {
+        if ( !Threads[t] )
+            continue;
+        for (UINT32 id = 0; id < Sites.size(); id++)
+        {
+            const malloc_site_stats_t *s = Threads[t]->_sites.find(id);
+            if ( !s )
+                continue;
+            stats[id]._allocs += s->_allocs;
+            stats[id]._bytes += s->_bytes;
+            stats[id]._freed += s->_freed;
+            stats[id]._lifetime += s->_lifetime;
+            stats[id]._shortLived += s->_shortLived;
+            stats[id]._remoteFrees += s->_remoteFrees;
+            for (UINT32 c = 0; c < MALLOCTRACE_SIZE_CLASSES; c++)
+                stats[id]._sizes[c] += s->_sizes[c];
+            for (UINT32 c = 0; c < MALLOCTRACE_LIFETIME_CLASSES; c++)
+                stats[id]._lifetimes[c] += s->_lifetimes[c];
+        }
+    }
+
+    // Blocks alive at exit
+    for (UINT32 i = 0; i < MALLOCTRACE_SHARDS; i++)
+    {
+        std::map<ADDRINT, malloc_block_t> &blocks = Shards[i]._blocks;
+        for (std::map<ADDRINT, malloc_block_t>::iterator it = blocks.begin(); it != blocks.end(); ++it)
+        {
+            stats[it->second._site]._survivors++;
+            stats[it->second._site]._survivorBytes += it->second._size;
+        }
+    }
+
+    std::vector<UINT64> allocs(Sites.size());
+    std::vector<UINT64> shortLived(Sites.size());
+    std::vector<UINT64> survivorBytes(Sites.size());
+    std::vector<UINT64> remoteFrees(Sites.size());
+    for (UINT32 id = 0; id < Sites.size(); id++)
+    {
+        allocs[id] = stats[id]._allocs;
+        shortLived[id] = stats[id]._shortLived;
+        survivorBytes[id] = stats[id]._survivorBytes;
+        remoteFrees[id] = stats[id]._remoteFrees;
+    }
+
+    // Without stacks everything is site 0, which is only worth a line in
+    // the lifetime reports
+    if ( SiteDepth )
+    {
+        std::vector< std::pair<UINT64, UINT32> > hot = MallocTrace_TopSites(allocs);
+        OutFile << endl << "Rank,Site,Allocs,Bytes,AvgSize,SizeClasses,Stack" << endl;
+        for (UINT32 i = 0; i < hot.size(); i++)
+        {
+            UINT32 id = hot[i].second;
+            malloc_site_stats_t &s = stats[id];
+            OutFile << i+1 << "," << hexstr(MallocTrace_SiteHash(id)) << "," << s._allocs << "," << s._bytes << ","
+                    << s._bytes / s._allocs << "," << MallocTrace_Histogram(s._sizes, MALLOCTRACE_SIZE_CLASSES) << ","
+                    << MallocTrace_SiteStack(id) << endl;
+        }
+    }
+
+    if ( RemoteFrees )
+    {
+        std::vector< std::pair<UINT64, UINT32> > remote = MallocTrace_TopSites(remoteFrees);
+        OutFile << endl << "Rank,Site,Allocs,RemoteFrees,Stack" << endl;
+        for (UINT32 i = 0; i < remote.size(); i++)
+        {
+            UINT32 id = remote[i].second;
+            OutFile << i+1 << "," << hexstr(MallocTrace_SiteHash(id)) << "," << stats[id]._allocs << ","
+                    << stats[id]._remoteFrees << "," << MallocTrace_SiteStack(id) << endl;
+        }
+    }
+
+    if ( !Lifetimes )
+        return;
+
+    // Sites whose blocks die young are the ones for stack, arena or bump
+    // allocation
+    std::vector< std::pair<UINT64, UINT32> > young = MallocTrace_TopSites(shortLived);
+    OutFile << endl << "Rank,Site,Allocs,Freed,ShortLived,AvgLifetime,LifetimeClasses,Stack" << endl;
+    for (UINT32 i = 0; i < young.size(); i++)
+    {
+        UINT32 id = young[i].second;
+        malloc_site_stats_t &s = stats[id];
+        OutFile << i+1 << "," << hexstr(MallocTrace_SiteHash(id)) << "," << s._allocs << "," << s._freed << ","
+                << s._shortLived << "," << (s._freed ? s._lifetime / s._freed : 0) << ","
+                << MallocTrace_Histogram(s._lifetimes, MALLOCTRACE_LIFETIME_CLASSES) << ","
+                << MallocTrace_SiteStack(id) << endl;
+    }
+
+    std::vector< std::pair<UINT64, UINT32> > survivors = MallocTrace_TopSites(survivorBytes);
+    OutFile << endl << "Rank,Site,Allocs,AliveAtExit,AliveBytes,Stack" << endl;
+    for (UINT32 i = 0; i < survivors.size(); i++)
+    {
+        UINT32 id = survivors[i].second;
+        malloc_site_stats_t &s = stats[id];
+        OutFile << i+1 << "," << hexstr(MallocTrace_SiteHash(id)) << "," << s._allocs << ","
+                << s._survivors << "," << s._survivorBytes << "," << MallocTrace_SiteStack(id) << endl;
+    }
+}
+
 // This routine is executed once at the end.
 VOID MallocTrace_Fini(INT32 code, VOID *v)
 {
+    // The writer is gone, write out what is left
+    if ( Tracing )
+        MallocTrace_Drain();
+
+    // Blocks still alive are leaks of the thread that allocated them
+    std::vector<UINT64> leakBlocks(NumThreads, 0);
+    std::vector<UINT64> leakBytes(NumThreads, 0);
+    for (UINT32 i = 0; i < MALLOCTRACE_SHARDS; i++)
+    {
+        std::map<ADDRINT, malloc_block_t> &blocks = Shards[i]._blocks;
+        for (std::map<ADDRINT, malloc_block_t>::iterator it = blocks.begin(); it != blocks.end(); ++it)
+        {
+            if ( (INT32)it->second._tid < NumThreads )
+            {
+                leakBlocks[it->second._tid]++;
+                leakBytes[it->second._tid] += it->second._size;
+            }
+        }
+    }
+
 	GetLock(&OutFileLock, BASE_LOCK_TAG);
+    OutFile << endl << "Peak,Bytes,Thread,ThreadAllocs,TimeMs" << endl;
+    OutFile << "peak," << HeapPeak << "," << HeapPeakThread << "," << HeapPeakAllocs << "," << HeapPeakTime << endl;
+
+    OutFile << endl << "Id,Allocs,Frees,UnknownFrees,RemoteFrees,BytesAllocated,BytesFreed,PeakBytes,LeakedBlocks,LeakedBytes,Dropped" << endl;
+    for (INT32 t = 0; t < NumThreads; t++)
+    {
+        malloc_thread_t *mt = Threads[t];
+        if ( !mt )
+            continue;
+        OutFile << t << "," << mt->_allocs << "," << mt->_frees << "," << mt->_unknownFrees << "," << mt->_remoteFrees << ","
+                << mt->_allocBytes << "," << mt->_freeBytes << "," << mt->_peak << ","
+                << leakBlocks[t] << "," << leakBytes[t] << "," << mt->_ring._dropped << endl;
+    }
+
+    if ( SiteStats )
+        MallocTrace_SiteReport();
+
+    // Producer (allocating thread) by consumer (freeing thread), the
+    // diagonal is left out as those frees are local
+    if ( RemoteFrees )
+    {
+        OutFile << endl << "Producer\\Consumer";
+        for (INT32 c = 0; c < NumThreads; c++)
+            OutFile << "," << c;
+        OutFile << endl;
+        for (INT32 p = 0; p < NumThreads; p++)
+        {
+            OutFile << p;
+            for (INT32 c = 0; c < NumThreads; c++)
+                OutFile << "," << (Threads[c] && c != p ? Threads[c]->_producers.get(p) : 0);
+            OutFile << endl;
+        }
+    }
+
     OutFile.close();
     ReleaseLock(&OutFileLock);
-}
\ No newline at end of file
+}
@@ -41,11 +41,155 @@ BOOL malloctrace(INT32 toolId);
 #define MALLOC "malloc"
 #define FREE "free"
 
+// Heap entry points, see MallocHooks for the symbols of each kind
+#define MALLOC_KIND_MALLOC 0            // (size)
+#define MALLOC_KIND_CALLOC 1            // (count, size)
+#define MALLOC_KIND_REALLOC 2           // (ptr, size)
+#define MALLOC_KIND_MEMALIGN 3          // (alignment, size), also aligned_alloc
+#define MALLOC_KIND_POSIX_MEMALIGN 4    // (memptr, alignment, size)
+#define MALLOC_KIND_VALLOC 5            // (size), also pvalloc
+#define MALLOC_KIND_NEW 6               // (size), operator new and new[]
+#define MALLOC_KIND_FREE 7              // (ptr)
+#define MALLOC_KIND_DELETE 8            // (ptr), operator delete and delete[]
+#define MALLOC_KIND_NUM 9
+
+// Trace events
+#define MALLOC_EVENT_THREAD_BEGIN 0
+#define MALLOC_EVENT_THREAD_END 1
+#define MALLOC_EVENT_ALLOC 2            // _arg0 address, _arg1 size
+#define MALLOC_EVENT_FREE 3             // _arg0 address, _arg1 size if known
+
+// Fixed size trace record, written by the traced thread into its ring
+typedef struct MallocRecord
+{
+    UINT32 _type;
+    THREADID _tid;
+    UINT32 _kind;
+    UINT64 _arg0;
+    UINT64 _arg1;
+} malloc_record_t;
+
+// Single producer/single consumer ring of trace records. The owning thread
+// appends at _head, the writer thread drains from _tail.
+#define MALLOCTRACE_MAX_THREADS 2048
+
+typedef struct MallocRing
+{
+    volatile UINT64 _head;
+    UINT8 _pad0[56];            // keep producer and consumer on their own lines
+    volatile UINT64 _tail;
+    UINT8 _pad1[56];
+    UINT64 _dropped;
+    UINT64 _mask;
+    malloc_record_t * _records;
+} malloc_ring_t;
+
+// Allocation sites are identified by a hash of the call stack at the
+// outermost entry point. Site 0 stands for unknown (site profiling off).
+#define MALLOCTRACE_MAX_FRAMES 16
+#define MALLOCTRACE_SIZE_CLASSES 48     // power of two size classes
+#define MALLOCTRACE_LIFETIME_CLASSES 48 // power of two lifetimes in instructions
+
+typedef struct MallocSite
+{
+    UINT64 _hash;
+    UINT32 _depth;
+    ADDRINT _frames[MALLOCTRACE_MAX_FRAMES];
+    string _stack;              // resolved on creation, before any dlclose
+} malloc_site_t;
+
+// Statistics of an allocation site, kept per thread
+typedef struct MallocSiteStats
+{
+    UINT64 _allocs;
+    UINT64 _bytes;
+    UINT64 _sizes[MALLOCTRACE_SIZE_CLASSES];
+    UINT64 _freed;              // blocks freed with a known lifetime
+    UINT64 _lifetime;           // sum of their lifetimes
+    UINT64 _shortLived;
+    UINT64 _lifetimes[MALLOCTRACE_LIFETIME_CLASSES];
+    UINT64 _survivors;          // blocks alive at exit, filled in at Fini
+    UINT64 _survivorBytes;
+    UINT64 _remoteFrees;        // blocks freed by another thread
+} malloc_site_stats_t;
+
+// A heap entry point that has been entered but not yet returned. Entry
+// points call each other (new calls malloc), only the outermost one counts.
+#define MALLOCTRACE_MAX_DEPTH 8
+
+typedef struct MallocCall
+{
+    UINT32 _kind;
+    ADDRINT _arg0;
+    ADDRINT _arg1;
+    ADDRINT _arg2;
+    ADDRINT _sp;                // stack pointer on entry
+    ADDRINT _retIp;             // return address, same for a tail call
+    ADDRINT _oldSize;           // realloc: size of the block it replaces
+    BOOL _oldKnown;
+    UINT32 _site;
+} malloc_call_t;
+
+// Per-thread state
+typedef struct MallocThread
+{
+    malloc_ring_t _ring;
+    malloc_call_t _calls[MALLOCTRACE_MAX_DEPTH];
+    UINT32 _depth;
+    UINT64 _allocs;
+    UINT64 _frees;
+    UINT64 _unknownFrees;       // frees of blocks we never saw allocated
+    UINT64 _remoteFrees;        // frees of blocks allocated by another thread
+    UINT64 _allocBytes;
+    UINT64 _freeBytes;
+    volatile UINT64 _current;   // live bytes allocated by this thread
+    UINT64 _peak;
+    std::map<UINT64, UINT32> _siteIds;              // site ids already looked up
+    chunked_table_t<malloc_site_stats_t> _sites;
+    counter_table_t _producers; // frees by allocating thread, our column of the matrix
+} malloc_thread_t;
+
+// A live heap block
+typedef struct MallocBlock
+{
+    ADDRINT _size;
+    THREADID _tid;              // allocating thread
+    UINT32 _site;
+    UINT64 _time;               // instruction count of the allocating thread
+} malloc_block_t;
+
+// The live blocks are spread over shards, each with its own lock, so that
+// threads rarely wait for each other.
+#define MALLOCTRACE_SHARDS 64
+
+typedef struct MallocShard
+{
+    PIN_LOCK _lock;
+    std::map<ADDRINT, malloc_block_t> _blocks;
+    UINT8 _pad[64];
+} malloc_shard_t;
+
+// Tools built on the live block table get told about each block that
+// enters or leaves it
+typedef VOID (*malloc_alloc_hook)(THREADID threadid, ADDRINT address, ADDRINT size, UINT32 site);
+typedef VOID (*malloc_free_hook)(THREADID threadid, ADDRINT address);
+
+/** Hooks the heap routines and keeps the live block table, trace tells if the
+ *  events get written to the output file. Lifetimes need the instruction
+ *  counters of inscount to be set up by the caller. */
+VOID MallocTrace_Register(BOOL trace, BOOL lifetimes, malloc_alloc_hook onAlloc, malloc_free_hook onFree);
+
+/** Allocation site as a CSV column of frames, and its hash */
+string MallocTrace_SiteStack(UINT32 site);
+UINT64 MallocTrace_SiteHash(UINT32 site);
+
+VOID MallocTrace_PrepareForFini(VOID *v);
 VOID MallocTrace_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
 VOID MallocTrace_ThreadFini(THREADID threadid, const CONTEXT *ctxt, INT32 code, VOID *v);
-VOID MallocTrace_BeforeMalloc( int size, THREADID threadid );
-VOID MallocTrace_AfterMalloc(ADDRINT ret, THREADID threadid);
+VOID MallocTrace_Enter(UINT32 kind, ADDRINT arg0, ADDRINT arg1, ADDRINT arg2, ADDRINT sp, ADDRINT retIp, THREADID threadid);
+VOID MallocTrace_EnterStack(UINT32 kind, ADDRINT arg0, ADDRINT arg1, ADDRINT arg2, ADDRINT sp, ADDRINT retIp, const CONTEXT *ctxt, THREADID threadid);
+VOID MallocTrace_Exit(ADDRINT ret, ADDRINT sp, THREADID threadid);
 VOID MallocTrace_Fini(INT32 code, VOID *v);
 VOID MallocTrace_ImageLoad(IMG img, VOID *);
 
-#endif // MEMPIN_MALLOCTRACE_H
\ No newline at end of file
+#endif // MEMPIN_MALLOCTRACE_H
@@ -0,0 +1,358 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_numa.h"
+
+KNOB<UINT32> KnobNumaNodes(KNOB_MODE_WRITEONCE, "pintool",
+    "numa_nodes", "0", "number of NUMA nodes, threads are placed round robin unless -numa_map is given.");
+
+KNOB<string> KnobNumaMap(KNOB_MODE_WRITEONCE, "pintool",
+    "numa_map", "", "comma separated node of each thread id, the list repeats for higher ids.");
+
+//
+// Tool Registration
+//
+
+BOOL numa(INT32 toolId)
+{
+    if ( toolId == TOOL_NUMA )
+    {
+        LOGI("Registering callbacks for numa");
+
+        // Per-thread data of inscount
+        Inscount_Init();
+        Numa_Init();
+
+        // Heap blocks from malloctrace, without writing the trace
+        MallocTrace_Register(FALSE, FALSE, Numa_Alloc, Numa_Free);
+
+        PIN_AddThreadStartFunction(Numa_ThreadStart, 0);
+        TRACE_AddInstrumentFunction(Numa_Trace, 0);
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(Numa_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// NUMA implementation
+//
+// Linux places a page on the node of the thread that touches it first.
+// Every page has an entry in a global shadow map that is only ever
+// extended: regions are installed and owners claimed with compare and
+// swap, so no access takes a lock. The owner's own accesses only bump a
+// counter of the accessing thread; accesses by other threads also count
+// on the page, which is where the sharing shows up.
+//
+// The first touch of a page looks up the heap block it belongs to, so
+// remote sharing can be charged to allocation sites. The allocator
+// usually touches a page before malloc returns the block on it, so new
+// blocks also claim the touched pages that have no site yet. Stack
+// accesses are left out.
+
+static numa_region_t * volatile Regions[NUMA_REGIONS];
+
+// Heap blocks by start address
+static std::map<ADDRINT, std::pair<ADDRINT, UINT32> > Blocks;
+static PIN_LOCK BlocksLock;
+
+// Node of each thread id, repeated for higher ids
+static std::vector<UINT32> Nodes;
+
+VOID Numa_Init()
+{
+    InitLock(&BlocksLock);
+
+    string map = KnobNumaMap.Value();
+    for (size_t start = 0; start < map.size(); )
+    {
+        size_t end = map.find(',', start);
+        if ( end == string::npos )
+            end = map.size();
+        Nodes.push_back(atoi(map.substr(start, end - start).c_str()));
+        start = end + 1;
+    }
+    if ( Nodes.empty() )
+    {
+        for (UINT32 n = 0; n < KnobNumaNodes.Value(); n++)
+            Nodes.push_back(n);
+    }
+}
+
+static UINT32 Numa_Node(THREADID threadid)
+{
+    return Nodes[threadid % Nodes.size()];
+}
+
+VOID Numa_Alloc(THREADID threadid, ADDRINT address, ADDRINT size, UINT32 site)
+{
+    GetLock(&BlocksLock, threadid+1);
+    Blocks[address] = std::make_pair(address + size, site);
+    ReleaseLock(&BlocksLock);
+
+    // Pages touched before the block was known, regions not installed
+    // yet have none
+    ADDRINT end = address + size;
+    for (ADDRINT page = address >> NUMA_PAGE_BITS; page <= (end - 1) >> NUMA_PAGE_BITS; )
+    {
+        ADDRINT region = page >> (NUMA_REGION_BITS - NUMA_PAGE_BITS);
+        if ( region >= NUMA_REGIONS )
+            break;
+
+        numa_region_t *shadow = Regions[region];
+        if ( !shadow )
+        {
+            page = (region + 1) << (NUMA_REGION_BITS - NUMA_PAGE_BITS);
+            continue;
+        }
+
+        numa_page_t &entry = shadow->_pages[page & (NUMA_PAGES - 1)];
+        if ( entry._owner && entry._site == NUMA_NO_SITE )
+            __sync_bool_compare_and_swap(&entry._site, NUMA_NO_SITE, site);
+        page++;
+    }
+}
+
+VOID Numa_Free(THREADID threadid, ADDRINT address)
+{
+    GetLock(&BlocksLock, threadid+1);
+    Blocks.erase(address);
+    ReleaseLock(&BlocksLock);
+}
+
+VOID Numa_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    numa_thread_t* nt = new numa_thread_t();
+    nt->_tid = threadid;
+    get_tls(threadid)->_tool = nt;
+}
+
+// Allocation site of a page on its first touch
+static UINT32 Numa_Site(ADDRINT address, THREADID threadid)
+{
+    UINT32 site = NUMA_NO_SITE;
+    GetLock(&BlocksLock, threadid+1);
+    std::map<ADDRINT, std::pair<ADDRINT, UINT32> >::iterator it = Blocks.upper_bound(address);
+    if ( it != Blocks.begin() && (--it)->second.first > address )
+        site = it->second.second;
+    ReleaseLock(&BlocksLock);
+    return site;
+}
+
+static inline VOID Numa_Access(numa_thread_t* nt, ADDRINT address)
+{
+    ADDRINT region = address >> NUMA_REGION_BITS;
+    if ( region >= NUMA_REGIONS )
+        return;
+
+    numa_region_t *shadow = Regions[region];
+    if ( !shadow )
+    {
+        // Racing threads install one region, the others drop theirs
+        numa_region_t *fresh = new numa_region_t();
+        for (UINT32 p = 0; p < NUMA_PAGES; p++)
+            fresh->_pages[p]._site = NUMA_NO_SITE;
+        shadow = __sync_val_compare_and_swap(&Regions[region], (numa_region_t *)0, fresh);
+        if ( shadow )
+            delete fresh;
+        else
+            shadow = fresh;
+    }
+
+    numa_page_t &page = shadow->_pages[(address >> NUMA_PAGE_BITS) & (NUMA_PAGES - 1)];
+    UINT32 self = nt->_tid + 1;
+    UINT32 owner = page._owner;
+    if ( !owner )
+    {
+        UINT32 site = Numa_Site(address, nt->_tid);
+        owner = __sync_val_compare_and_swap(&page._owner, 0, self);
+        if ( !owner )
+        {
+            owner = self;
+            if ( site != NUMA_NO_SITE )
+                __sync_bool_compare_and_swap(&page._site, NUMA_NO_SITE, site);
+        }
+    }
+    nt->_accesses[owner - 1]++;
+
+    if ( owner != self )
+    {
+        __sync_fetch_and_add(&page._remote, 1);
+        UINT32 sharer = 1U << (nt->_tid & 31);
+        if ( !(page._sharers & sharer) )
+            __sync_fetch_and_or(&page._sharers, sharer);
+    }
+}
+
+VOID numa_access(ADDRINT address, THREADID threadid)
+{
+    Numa_Access(static_cast<numa_thread_t*>(get_tls(threadid)->_tool), address);
+}
+
+VOID numa_access_reg(ADDRINT address, thread_data_t* tdata)
+{
+    Numa_Access(static_cast<numa_thread_t*>(tdata->_tool), address);
+}
+
+VOID Numa_Trace(TRACE trace, VOID *v)
+{
+    REG reg = Inscount_ToolReg();
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if ( !Filter_Bbl(bbl) )
+            continue;
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            if ( INS_IsStackRead(ins) || INS_IsStackWrite(ins) || INS_IsPrefetch(ins) )
+                continue;
+
+            for (UINT32 op = 0; op < INS_MemoryOperandCount(ins); op++)
+            {
+                if ( REG_valid(reg) )
+                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)numa_access_reg,
+                                             IARG_MEMORYOP_EA, op, IARG_REG_VALUE, reg, IARG_END);
+                else
+                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)numa_access,
+                                             IARG_MEMORYOP_EA, op, IARG_THREAD_ID, IARG_END);
+            }
+        }
+    }
+}
+
+static bool Numa_Compare(const std::pair<UINT64, ADDRINT> &a, const std::pair<UINT64, ADDRINT> &b)
+{
+    return a.first > b.first;
+}
+
+static UINT32 Numa_Count(UINT32 set)
+{
+    UINT32 count = 0;
+    for (; set; set &= set - 1)
+        count++;
+    return count;
+}
+
+VOID Numa_Fini(INT32 code, VOID *v)
+{
+    // Pages and sites by remote accesses
+    std::vector< std::pair<UINT64, ADDRINT> > pages;
+    std::map<UINT32, std::pair<UINT64, UINT64> > sites;     // pages, remote accesses
+    for (UINT32 r = 0; r < NUMA_REGIONS; r++)
+    {
+        if ( !Regions[r] )
+            continue;
+        for (UINT32 p = 0; p < NUMA_PAGES; p++)
+        {
+            numa_page_t &page = Regions[r]->_pages[p];
+            if ( !page._remote )
+                continue;
+            pages.push_back(std::make_pair(page._remote, ((ADDRINT)r << NUMA_REGION_BITS) + ((ADDRINT)p << NUMA_PAGE_BITS)));
+            UINT32 site = page._site;
+            if ( site != NUMA_NO_SITE )
+            {
+                sites[site].first++;
+                sites[site].second += page._remote;
+            }
+        }
+    }
+    UINT32 topN = std::min((size_t)KnobTopN.Value(), pages.size());
+    std::partial_sort(pages.begin(), pages.begin() + topN, pages.end(), Numa_Compare);
+
+    std::vector< std::pair<UINT64, ADDRINT> > hotSites;
+    for (std::map<UINT32, std::pair<UINT64, UINT64> >::iterator it = sites.begin(); it != sites.end(); ++it)
+        hotSites.push_back(std::make_pair(it->second.second, it->first));
+    UINT32 topSites = std::min((size_t)KnobTopN.Value(), hotSites.size());
+    std::partial_sort(hotSites.begin(), hotSites.begin() + topSites, hotSites.end(), Numa_Compare);
+
+    // Accesses to pages of other threads and, with a node mapping, of
+    // other nodes
+    UINT64 total = 0;
+    UINT64 remote = 0;
+    UINT64 remoteNode = 0;
+    for (INT32 a = 0; a < numThreads; a++)
+    {
+        numa_thread_t* nt = static_cast<numa_thread_t*>(get_tls(a)->_tool);
+        for (INT32 o = 0; o < numThreads; o++)
+        {
+            UINT64 accesses = nt->_accesses.get(o);
+            total += accesses;
+            remote += o != a ? accesses : 0;
+            remoteNode += !Nodes.empty() && Numa_Node(o) != Numa_Node(a) ? accesses : 0;
+        }
+    }
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    OutFile << "# Accesses: " << total << ", to pages first touched by another thread: " << remote
+            << " (" << (total ? (double)remote / total : 0.0) << ")" << endl;
+    if ( !Nodes.empty() )
+        OutFile << "# Expected remote node accesses: " << remoteNode
+                << " (" << (total ? (double)remoteNode / total : 0.0) << ")" << endl;
+
+    // Owner (first touch) by accessing thread
+    OutFile << endl << "Owner\\Accessor";
+    for (INT32 a = 0; a < numThreads; a++)
+        OutFile << "," << a;
+    OutFile << endl;
+    for (INT32 o = 0; o < numThreads; o++)
+    {
+        OutFile << o;
+        for (INT32 a = 0; a < numThreads; a++)
+            OutFile << "," << static_cast<numa_thread_t*>(get_tls(a)->_tool)->_accesses.get(o);
+        OutFile << endl;
+    }
+
+    OutFile << endl << "Rank,Page,FirstTouch,RemoteAccesses,Sharers,Site" << endl;
+    for (UINT32 i = 0; i < topN; i++)
+    {
+        ADDRINT address = pages[i].second;
+        numa_page_t &page = Regions[address >> NUMA_REGION_BITS]->_pages[(address >> NUMA_PAGE_BITS) & (NUMA_PAGES - 1)];
+        OutFile << i+1 << "," << hexstr(address) << "," << page._owner - 1 << "," << page._remote << ","
+                << Numa_Count(page._sharers) << ","
+                << (page._site != NUMA_NO_SITE ? hexstr(MallocTrace_SiteHash(page._site)) : "") << endl;
+    }
+
+    OutFile << endl << "Rank,Site,Pages,RemoteAccesses,Stack" << endl;
+    for (UINT32 i = 0; i < topSites; i++)
+    {
+        UINT32 site = hotSites[i].second;
+        OutFile << i+1 << "," << hexstr(MallocTrace_SiteHash(site)) << "," << sites[site].first << ","
+                << sites[site].second << "," << MallocTrace_SiteStack(site) << endl;
+    }
+
+    Filter_Report(OutFile);
+    OutFile.close();
+    ReleaseLock(&OutFileLock);
+}
@@ -0,0 +1,88 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_NUMA_H
+#define MEMPIN_NUMA_H
+
+//
+// Tool entry points
+//
+
+BOOL numa(INT32 toolId);
+
+// Shadow map of pages: a directory of 1 GB regions over the 47 bit user
+// address space, each region one entry per 4 KB page
+#define NUMA_PAGE_BITS 12
+#define NUMA_REGION_BITS 30
+#define NUMA_ADDRESS_BITS 47
+#define NUMA_REGIONS (1 << (NUMA_ADDRESS_BITS - NUMA_REGION_BITS))
+#define NUMA_PAGES (1 << (NUMA_REGION_BITS - NUMA_PAGE_BITS))
+
+// Site of pages that are not part of a heap block
+#define NUMA_NO_SITE 0xffffffff
+
+typedef struct NumaPage
+{
+    volatile UINT32 _owner;     // first touching thread + 1, 0 if untouched
+    volatile UINT32 _site;      // malloctrace site of the first block seen on it
+    volatile UINT32 _sharers;   // threads touching it, modulo 32
+    volatile UINT64 _remote;    // accesses by other threads than the owner
+} numa_page_t;
+
+typedef struct NumaRegion
+{
+    numa_page_t _pages[NUMA_PAGES];
+} numa_region_t;
+
+// Per-thread state, kept in thread_data_t::_tool
+typedef struct NumaThread
+{
+    THREADID _tid;
+    counter_table_t _accesses;  // accesses by first touching thread, our column of the matrix
+} numa_thread_t;
+
+/** Sets up the shadow map and the thread to node mapping */
+VOID Numa_Init();
+
+/** Live block table hooks of malloctrace */
+VOID Numa_Alloc(THREADID threadid, ADDRINT address, ADDRINT size, UINT32 site);
+VOID Numa_Free(THREADID threadid, ADDRINT address);
+
+/** Thread start callback, sets up the per-thread counters */
+VOID Numa_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
+
+/** Trace instrumentation, hooks all memory operands */
+VOID Numa_Trace(TRACE trace, VOID *v);
+
+/** Finish callback */
+VOID Numa_Fini(INT32 code, VOID *v);
+
+#endif // MEMPIN_NUMA_H
@@ -0,0 +1,333 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_objprof.h"
+
+KNOB<UINT32> KnobObjGranule(KNOB_MODE_WRITEONCE, "pintool",
+    "obj_granule", "8", "bytes per bucket of the objprof offset histogram.");
+
+#define OBJPROF_READ 1
+#define OBJPROF_WRITE 2
+
+// Index of the live heap blocks
+static objprof_shard_t Shards[OBJPROF_SHARDS];
+static volatile ADDRINT HeapLow = ~(ADDRINT)0;
+static volatile ADDRINT HeapHigh = 0;
+static volatile UINT32 NumSites = 1;
+static UINT32 Granule = 8;
+
+//
+// Tool Registration
+//
+
+BOOL objprof(INT32 toolId)
+{
+    if ( toolId == TOOL_OBJPROF )
+    {
+        LOGI("Registering callbacks for objprof");
+
+        // Per-thread data of inscount
+        Inscount_Init();
+        for (UINT32 i = 0; i < OBJPROF_SHARDS; i++)
+            PIN_RWMutexInit(&Shards[i]._lock);
+        Granule = std::max(KnobObjGranule.Value(), (UINT32)1);
+
+        // Live heap blocks from malloctrace, without writing the trace
+        MallocTrace_Register(FALSE, FALSE, ObjProf_Alloc, ObjProf_Free);
+
+        PIN_AddThreadStartFunction(ObjProf_ThreadStart, 0);
+        TRACE_AddInstrumentFunction(ObjProf_Trace, 0);
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(ObjProf_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// Object profiler implementation
+//
+// Loads and stores are attributed to the heap block they touch. The blocks
+// come from the live table of malloctrace and are kept in an interval index
+// sorted by start address, sharded by 64 KB region. A block is entered in
+// the shard of every region it covers, so the shard of an address always
+// holds its block. Lookups take a shared lock, allocations and frees the
+// exclusive one of the few shards involved.
+//
+// Most accesses hit the same block as the previous access of the thread, so
+// each thread remembers its last block. A free clears the caches holding
+// the block, after the block left the index. Addresses outside of anything
+// ever allocated skip the index entirely.
+
+static objprof_thread_t* get_objprof(THREADID threadid)
+{
+    return static_cast<objprof_thread_t*>(get_tls(threadid)->_tool);
+}
+
+static inline objprof_shard_t* ObjProf_Shard(ADDRINT address)
+{
+    return &Shards[(address >> OBJPROF_REGION_BITS) & (OBJPROF_SHARDS - 1)];
+}
+
+// Number of shards a block is entered in, starting at its first region
+static inline UINT32 ObjProf_Regions(ADDRINT address, ADDRINT end)
+{
+    ADDRINT regions = ((std::max(end, address + 1) - 1) >> OBJPROF_REGION_BITS) - (address >> OBJPROF_REGION_BITS) + 1;
+    return std::min(regions, (ADDRINT)OBJPROF_SHARDS);
+}
+
+VOID ObjProf_Alloc(THREADID threadid, ADDRINT address, ADDRINT size, UINT32 site)
+{
+    objprof_block_t block;
+    block._end = address + size;
+    block._site = site;
+
+    UINT32 regions = ObjProf_Regions(address, block._end);
+    for (UINT32 r = 0; r < regions; r++)
+    {
+        objprof_shard_t *shard = ObjProf_Shard(address + ((ADDRINT)r << OBJPROF_REGION_BITS));
+        PIN_RWMutexWriteLock(&shard->_lock);
+        shard->_blocks[address] = block;
+        PIN_RWMutexUnlock(&shard->_lock);
+    }
+
+    ADDRINT low = HeapLow;
+    while ( address < low && !__sync_bool_compare_and_swap(&HeapLow, low, address) )
+        low = HeapLow;
+    ADDRINT high = HeapHigh;
+    while ( block._end > high && !__sync_bool_compare_and_swap(&HeapHigh, high, block._end) )
+        high = HeapHigh;
+    UINT32 sites = NumSites;
+    while ( site >= sites && !__sync_bool_compare_and_swap(&NumSites, sites, site + 1) )
+        sites = NumSites;
+}
+
+VOID ObjProf_Free(THREADID threadid, ADDRINT address)
+{
+    objprof_shard_t *shard = ObjProf_Shard(address);
+    PIN_RWMutexWriteLock(&shard->_lock);
+    std::map<ADDRINT, objprof_block_t>::iterator it = shard->_blocks.find(address);
+    if ( it == shard->_blocks.end() )
+    {
+        PIN_RWMutexUnlock(&shard->_lock);
+        return;
+    }
+    UINT32 regions = ObjProf_Regions(address, it->second._end);
+    shard->_blocks.erase(it);
+    PIN_RWMutexUnlock(&shard->_lock);
+
+    for (UINT32 r = 1; r < regions; r++)
+    {
+        shard = ObjProf_Shard(address + ((ADDRINT)r << OBJPROF_REGION_BITS));
+        PIN_RWMutexWriteLock(&shard->_lock);
+        shard->_blocks.erase(address);
+        PIN_RWMutexUnlock(&shard->_lock);
+    }
+
+    // Only the threads that last hit this block lose their cache
+    for (INT32 t = 0; t < numThreads; t++)
+    {
+        thread_data_t* tdata = get_tls(t);
+        objprof_thread_t* ot = tdata ? static_cast<objprof_thread_t*>(tdata->_tool) : 0;
+        if ( ot && ot->_start == address )
+            ot->_end = 0;
+    }
+}
+
+VOID ObjProf_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    objprof_thread_t* ot = new objprof_thread_t();
+    get_tls(threadid)->_tool = ot;
+}
+
+// Find the block of an address, returns FALSE if it is not on the heap
+static BOOL ObjProf_Lookup(objprof_thread_t* ot, ADDRINT address)
+{
+    if ( address >= ot->_start && address < ot->_end )
+        return TRUE;
+    if ( address < HeapLow || address >= HeapHigh )
+        return FALSE;
+
+    BOOL found = FALSE;
+    objprof_shard_t *shard = ObjProf_Shard(address);
+    PIN_RWMutexReadLock(&shard->_lock);
+    std::map<ADDRINT, objprof_block_t>::iterator it = shard->_blocks.upper_bound(address);
+    if ( it != shard->_blocks.begin() )
+    {
+        --it;
+        if ( address < it->second._end )
+        {
+            ot->_start = it->first;
+            ot->_end = it->second._end;
+            ot->_site = it->second._site;
+            found = TRUE;
+        }
+    }
+    PIN_RWMutexUnlock(&shard->_lock);
+    return found;
+}
+
+static inline VOID ObjProf_Count(objprof_thread_t* ot, ADDRINT address, UINT32 size, UINT32 access)
+{
+    if ( !ObjProf_Lookup(ot, address) )
+    {
+        ot->_otherAccesses++;
+        return;
+    }
+    ot->_heapAccesses++;
+
+    objprof_site_t &site = ot->_sites[ot->_site];
+    if ( access & OBJPROF_READ )
+    {
+        site._reads++;
+        site._readBytes += size;
+    }
+    if ( access & OBJPROF_WRITE )
+    {
+        site._writes++;
+        site._writeBytes += size;
+    }
+    UINT32 bucket = (address - ot->_start) / Granule;
+    site._offsets[std::min(bucket, (UINT32)OBJPROF_OFFSET_BUCKETS - 1)]++;
+}
+
+VOID objprof_access(ADDRINT address, UINT32 size, UINT32 access, THREADID threadid)
+{
+    ObjProf_Count(get_objprof(threadid), address, size, access);
+}
+
+VOID objprof_access_reg(ADDRINT address, UINT32 size, UINT32 access, thread_data_t* tdata)
+{
+    ObjProf_Count(static_cast<objprof_thread_t*>(tdata->_tool), address, size, access);
+}
+
+VOID ObjProf_Trace(TRACE trace, VOID *v)
+{
+    REG reg = Inscount_ToolReg();
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if ( !Filter_Bbl(bbl) )
+            continue;
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            // The stack is never part of the heap
+            if ( INS_IsStackRead(ins) || INS_IsStackWrite(ins) || INS_IsPrefetch(ins) )
+                continue;
+
+            for (UINT32 op = 0; op < INS_MemoryOperandCount(ins); op++)
+            {
+                UINT32 access = (INS_MemoryOperandIsRead(ins, op) ? OBJPROF_READ : 0)
+                              | (INS_MemoryOperandIsWritten(ins, op) ? OBJPROF_WRITE : 0);
+
+                if ( REG_valid(reg) )
+                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)objprof_access_reg,
+                                             IARG_MEMORYOP_EA, op, IARG_UINT32, INS_MemoryOperandSize(ins, op),
+                                             IARG_UINT32, access, IARG_REG_VALUE, reg, IARG_END);
+                else
+                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)objprof_access,
+                                             IARG_MEMORYOP_EA, op, IARG_UINT32, INS_MemoryOperandSize(ins, op),
+                                             IARG_UINT32, access, IARG_THREAD_ID, IARG_END);
+            }
+        }
+    }
+}
+
+static bool ObjProf_CompareSites(const std::pair<UINT64, UINT32> &a, const std::pair<UINT64, UINT32> &b)
+{
+    return a.first > b.first;
+}
+
+VOID ObjProf_Fini(INT32 code, VOID *v)
+{
+    std::vector<objprof_site_t> sites(NumSites);
+    UINT64 heapAccesses = 0;
+    UINT64 otherAccesses = 0;
+
+    for (INT32 t = 0; t < numThreads; t++)
+    {
+        objprof_thread_t* ot = get_objprof(t);
+        heapAccesses += ot->_heapAccesses;
+        otherAccesses += ot->_otherAccesses;
+
+        for (UINT32 id = 0; id < NumSites; id++)
+        {
+            const objprof_site_t *s = ot->_sites.find(id);
+            if ( !s )
+                continue;
+            sites[id]._reads += s->_reads;
+            sites[id]._writes += s->_writes;
+            sites[id]._readBytes += s->_readBytes;
+            sites[id]._writeBytes += s->_writeBytes;
+            for (UINT32 b = 0; b < OBJPROF_OFFSET_BUCKETS; b++)
+                sites[id]._offsets[b] += s->_offsets[b];
+        }
+    }
+
+    // Top sites by accesses
+    std::vector< std::pair<UINT64, UINT32> > hot;
+    for (UINT32 id = 0; id < NumSites; id++)
+    {
+        UINT64 accesses = sites[id]._reads + sites[id]._writes;
+        if ( accesses )
+            hot.push_back(std::make_pair(accesses, id));
+    }
+    UINT32 topN = std::min((size_t)KnobTopN.Value(), hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + topN, hot.end(), ObjProf_CompareSites);
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    OutFile << "# Heap accesses: " << heapAccesses << " of " << heapAccesses + otherAccesses << endl;
+    OutFile << "Rank,Site,Reads,Writes,ReadWriteRatio,ReadBytes,WriteBytes,Offsets,Stack" << endl;
+    for (UINT32 i = 0; i < topN; i++)
+    {
+        UINT32 id = hot[i].second;
+        objprof_site_t &s = sites[id];
+
+        // Offset histogram as "offset:count" pairs, hot fields stand out
+        string offsets;
+        for (UINT32 b = 0; b < OBJPROF_OFFSET_BUCKETS; b++)
+        {
+            if ( s._offsets[b] )
+                offsets += decstr(b * Granule) + (b == OBJPROF_OFFSET_BUCKETS - 1 ? "+:" : ":")
+                         + decstr(s._offsets[b]) + " ";
+        }
+
+        OutFile << i+1 << "," << hexstr(MallocTrace_SiteHash(id)) << "," << s._reads << "," << s._writes << ","
+                << (s._writes ? (double)s._reads / s._writes : (double)s._reads) << ","
+                << s._readBytes << "," << s._writeBytes << "," << offsets << "," << MallocTrace_SiteStack(id) << endl;
+    }
+    Filter_Report(OutFile);
+    OutFile.close();
+    ReleaseLock(&OutFileLock);
+}
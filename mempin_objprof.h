@@ -0,0 +1,100 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_OBJPROF_H
+#define MEMPIN_OBJPROF_H
+
+//
+// Tool entry points
+//
+
+BOOL objprof(INT32 toolId);
+
+// Offsets into a block are counted in buckets of -obj_granule bytes, the
+// last bucket takes everything past the end of the histogram
+#define OBJPROF_OFFSET_BUCKETS 64
+
+// Live heap block in the address index
+typedef struct ObjprofBlock
+{
+    ADDRINT _end;
+    UINT32 _site;               // malloctrace allocation site
+} objprof_block_t;
+
+// The index is sharded by 64 KB region, so threads working on different
+// parts of the heap rarely wait for each other
+#define OBJPROF_SHARDS 64
+#define OBJPROF_REGION_BITS 16
+
+typedef struct ObjprofShard
+{
+    PIN_RWMUTEX _lock;
+    std::map<ADDRINT, objprof_block_t> _blocks;
+    UINT8 _pad[64];
+} objprof_shard_t;
+
+// Accesses to the blocks of one allocation site
+typedef struct ObjprofSite
+{
+    UINT64 _reads;
+    UINT64 _writes;
+    UINT64 _readBytes;
+    UINT64 _writeBytes;
+    UINT64 _offsets[OBJPROF_OFFSET_BUCKETS];
+} objprof_site_t;
+
+// Per-thread state, kept in thread_data_t::_tool
+typedef struct ObjprofThread
+{
+    // Last block hit, cleared when that block is freed
+    ADDRINT _start;
+    volatile ADDRINT _end;
+    UINT32 _site;
+
+    UINT64 _heapAccesses;
+    UINT64 _otherAccesses;
+    chunked_table_t<objprof_site_t> _sites;
+} objprof_thread_t;
+
+/** Live block table hooks of malloctrace */
+VOID ObjProf_Alloc(THREADID threadid, ADDRINT address, ADDRINT size, UINT32 site);
+VOID ObjProf_Free(THREADID threadid, ADDRINT address);
+
+/** Thread start callback, sets up the per-thread tables */
+VOID ObjProf_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
+
+/** Trace instrumentation, hooks all memory operands */
+VOID ObjProf_Trace(TRACE trace, VOID *v);
+
+/** Finish callback */
+VOID ObjProf_Fini(INT32 code, VOID *v);
+
+#endif // MEMPIN_OBJPROF_H
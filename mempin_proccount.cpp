@@ -32,6 +32,9 @@
 #include "mempin.h"
 #include "mempin_proccount.h"
 
+KNOB<BOOL> KnobProccountPerThread(KNOB_MODE_WRITEONCE, "pintool",
+    "proc_per_thread", "0", "add a per-thread breakdown to the proccount report.");
+
 //
 // Tool Registration
 //
@@ -42,9 +45,15 @@ BOOL proccount(INT32 toolId)
     {
     	LOGI("Registering callbacks for proccount");
 
+        // Per-thread counters of inscount
+        Inscount_Init();
+
     	// Register Routine to be called to instrument rtn
     	RTN_AddInstrumentFunction(Proccount_Instruction, 0);
 
+        // Register the trace callback counting the instructions
+        TRACE_AddInstrumentFunction(Proccount_Trace, 0);
+
 	    // Register Fini to be called when the application exits.
 	  	PIN_AddFiniFunction(Proccount_Fini, 0);
         return TRUE;
@@ -55,19 +64,28 @@ BOOL proccount(INT32 toolId)
 //
 // ProcCount implemention
 //
+// Each routine gets an id when it is first seen. The counters are private
+// to each thread (see thread_data_t), so threads do not fight over the
+// cache lines of hot routines.
 
 // Linked list of instruction counts for each routine
 RTN_COUNT * RtnList = 0;
 
-// The count implementation
-VOID PIN_FAST_ANALYSIS_CALL proccount_docount(UINT64 * counter)
-{
-	(*counter)++;
-}
+// Routines indexed by their id
+std::vector<RTN_COUNT *> RtnTable;
 
-// For eacj instruction count what is in there
-VOID Proccount_Instruction(RTN rtn, VOID *v)
+// Routine id by address
+static std::map<ADDRINT, UINT32> RtnIds;
+
+UINT32 Proccount_RtnId(RTN rtn)
 {
+	ADDRINT address = RTN_Address(rtn);
+	std::map<ADDRINT, UINT32>::iterator it = RtnIds.find(address);
+
+	// An unloaded image may leave a routine behind at the same address
+	if ( it != RtnIds.end() && RtnTable[it->second]->_name == RTN_Name(rtn) )
+		return it->second;
+
 	// Allocate a counter for this routine
 	RTN_COUNT * rc = new RTN_COUNT;
 
@@ -75,33 +93,102 @@ VOID Proccount_Instruction(RTN rtn, VOID *v)
 	// because we need it in the fini
 	rc->_name = RTN_Name(rtn);
 	rc->_image = StripPath(IMG_Name(SEC_Img(RTN_Sec(rtn))).c_str());
-	rc->_address = RTN_Address(rtn);
+	rc->_address = address;
+	rc->_id = RtnTable.size();
 	rc->_icount = 0;
 	rc->_rtnCount = 0;
 
 	// Add to list of routines
 	rc->_next = RtnList;
 	RtnList = rc;
+	RtnTable.push_back(rc);
+	RtnIds[address] = rc->_id;
+
+	return rc->_id;
+}
+
+// Count a call of the routine
+VOID PIN_FAST_ANALYSIS_CALL proccount_call(UINT32 id, THREADID threadid)
+{
+	get_tls(threadid)->_rtnCalls[id]++;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL proccount_call_reg(UINT32 id, thread_data_t* tdata)
+{
+	tdata->_rtnCalls[id]++;
+}
+
+// Count the instructions of a BBL
+VOID PIN_FAST_ANALYSIS_CALL proccount_docount(UINT32 id, UINT32 c, THREADID threadid)
+{
+	get_tls(threadid)->_rtnIns[id] += c;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL proccount_docount_reg(UINT32 id, UINT32 c, thread_data_t* tdata)
+{
+	tdata->_rtnIns[id] += c;
+}
+
+// Register the routine and count its calls
+VOID Proccount_Instruction(RTN rtn, VOID *v)
+{
+	if ( !Filter_Rtn(rtn) )
+		return;
+
+	UINT32 id = Proccount_RtnId(rtn);
+	REG reg = Inscount_ToolReg();
 
 	RTN_Open(rtn);
 
 	// Insert a call at the entry point of a routine to increment the call count
-	RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)proccount_docount, IARG_PTR, &(rc->_rtnCount), IARG_END);
+	if ( REG_valid(reg) )
+		RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)proccount_call_reg, IARG_FAST_ANALYSIS_CALL,
+					   IARG_UINT32, id, IARG_REG_VALUE, reg, IARG_END);
+	else
+		RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)proccount_call, IARG_FAST_ANALYSIS_CALL,
+					   IARG_UINT32, id, IARG_THREAD_ID, IARG_END);
 
-	// For each instruction of the routine
-	for (INS ins = RTN_InsHead(rtn); INS_Valid(ins); ins = INS_Next(ins))
-	{
-		// Insert a call to proccount_docount to increment the instruction counter for this rtn
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)proccount_docount, IARG_PTR, &(rc->_icount), IARG_END);
-	}
+	RTN_Close(rtn);
+}
 
+// Count the instructions of each BBL for the routine it belongs to
+VOID Proccount_Trace(TRACE trace, VOID *v)
+{
+	REG reg = Inscount_ToolReg();
 
-	RTN_Close(rtn);
+	for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+	{
+		if ( !Filter_Bbl(bbl) )
+			continue;
+
+		RTN rtn = RTN_FindByAddress(BBL_Address(bbl));
+		if ( !RTN_Valid(rtn) )
+			continue;
+
+		UINT32 id = Proccount_RtnId(rtn);
+		if ( REG_valid(reg) )
+			BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)proccount_docount_reg, IARG_FAST_ANALYSIS_CALL,
+						   IARG_UINT32, id, IARG_UINT32, BBL_NumIns(bbl), IARG_REG_VALUE, reg, IARG_END);
+		else
+			BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)proccount_docount, IARG_FAST_ANALYSIS_CALL,
+						   IARG_UINT32, id, IARG_UINT32, BBL_NumIns(bbl), IARG_THREAD_ID, IARG_END);
+	}
 }
 
 // This function is called when the application exits
 VOID Proccount_Fini(INT32 code, VOID *v)
 {
+	// Merge the counters of all threads
+	for (RTN_COUNT * rc = RtnList; rc; rc = rc->_next)
+	{
+		for (INT32 t=0; t<numThreads; t++)
+		{
+			thread_data_t* tdata = get_tls(t);
+			rc->_rtnCount += tdata->_rtnCalls.get(rc->_id);
+			rc->_icount += tdata->_rtnIns.get(rc->_id);
+		}
+	}
+
 	GetLock(&OutFileLock, BASE_LOCK_TAG);
 	// Write all collected data to the output file
 	OutFile << setw(23) << "Procedure" << " "
@@ -119,6 +206,36 @@ VOID Proccount_Fini(INT32 code, VOID *v)
 					<< setw(12) << rc->_rtnCount << " "
 					<< setw(12) << rc->_icount << endl;
 	}
+
+	// Per-thread breakdown
+	if ( KnobProccountPerThread.Value() )
+	{
+		OutFile << endl
+				<< setw(6) << "Thread" << " "
+				<< setw(23) << "Procedure" << " "
+				<< setw(15) << "Image" << " "
+				<< setw(18) << "Address" << " "
+				<< setw(12) << "Calls" << " "
+				<< setw(12) << "Instructions" << endl;
+
+		for (INT32 t=0; t<numThreads; t++)
+		{
+			thread_data_t* tdata = get_tls(t);
+			for (RTN_COUNT * rc = RtnList; rc; rc = rc->_next)
+			{
+				UINT64 icount = tdata->_rtnIns.get(rc->_id);
+				if (icount > 0)
+					OutFile << setw(6) << t << " "
+							<< setw(23) << rc->_name << " "
+							<< setw(15) << rc->_image << " "
+							<< setw(18) << hex << rc->_address << dec <<" "
+							<< setw(12) << tdata->_rtnCalls.get(rc->_id) << " "
+							<< setw(12) << icount << endl;
+			}
+		}
+	}
+
+	Filter_Report(OutFile);
     OutFile.close();
     ReleaseLock(&OutFileLock);
-}
\ No newline at end of file
+}
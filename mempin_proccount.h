@@ -38,13 +38,14 @@
 
 BOOL proccount(INT32 toolId);
 
-// Holds instruction count for a single procedure
+// Holds instruction count for a single procedure. The counts are kept per
+// thread in thread_data_t, indexed by _id, and merged in Proccount_Fini.
 typedef struct RtnCount
 {
     string _name;
     string _image;
     ADDRINT _address;
-    RTN _rtn;
+    UINT32 _id;
     UINT64 _rtnCount;
     UINT64 _icount;
     struct RtnCount * _next;
@@ -53,12 +54,24 @@ typedef struct RtnCount
 // Linked list of instruction counts for each routine
 extern RTN_COUNT * RtnList;
 
-/** Procedure counter */
-VOID Proccount_docount(UINT64 * counter);
+// Routines indexed by their id
+extern std::vector<RTN_COUNT *> RtnTable;
+
+/** Id of a routine, the routine gets registered on first use */
+UINT32 Proccount_RtnId(RTN rtn);
+
+/** Routine call counter */
+VOID PIN_FAST_ANALYSIS_CALL proccount_call(UINT32 id, THREADID threadid);
+
+/** Instruction counter, one call per BBL */
+VOID PIN_FAST_ANALYSIS_CALL proccount_docount(UINT32 id, UINT32 c, THREADID threadid);
 
 /** Instruction instrumentation */
 VOID Proccount_Instruction(RTN rtn, VOID *v);
 
+/** Trace instrumentation, counts the instructions of each BBL for its routine */
+VOID Proccount_Trace(TRACE trace, VOID *v);
+
 /** Finish callback */
 VOID Proccount_Fini(INT32 code, VOID *v);
 
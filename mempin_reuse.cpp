@@ -0,0 +1,305 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_reuse.h"
+
+#include <stddef.h>
+
+KNOB<UINT32> KnobReuseLine(KNOB_MODE_WRITEONCE, "pintool",
+    "reuse_line", "64", "line size in bytes for reuse distances.");
+
+KNOB<UINT32> KnobReuseSample(KNOB_MODE_WRITEONCE, "pintool",
+    "reuse_sample", "1", "track one in N lines, picked by address hash, and scale distances by N.");
+
+//
+// Tool Registration
+//
+
+BOOL reuse(INT32 toolId)
+{
+    if ( toolId == TOOL_REUSE )
+    {
+        LOGI("Registering callbacks for reuse");
+
+        // Per-thread data of inscount
+        Inscount_Init();
+
+        Reuse_Init();
+        PIN_AddThreadStartFunction(Reuse_ThreadStart, 0);
+        TRACE_AddInstrumentFunction(Reuse_Trace, 0);
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(Reuse_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// Reuse distance implementation
+//
+// The reuse distance of an access is the number of distinct lines the
+// thread touched since its previous access to the same line, the smallest
+// fully associative LRU cache that hits is one line larger. Each thread
+// stamps its accesses with a running timestamp and marks in a Fenwick tree
+// the timestamps that are still the last access of some line. The distance
+// is then the number of marks after the previous access of the line, one
+// O(log n) query. When the timestamps run out of the tree, the live ones
+// are renumbered in order.
+//
+// References are batched through Pin trace buffers like in cachesim. With
+// -reuse_sample N only lines whose hash falls in one of N buckets are
+// tracked, the distances among them are scaled back by N.
+
+static UINT32 LineShift = 6;
+static UINT32 SampleRate = 1;
+static BUFFER_ID RefBuffer;
+
+static reuse_thread_t* get_reuse(THREADID threadid)
+{
+    return static_cast<reuse_thread_t*>(get_tls(threadid)->_tool);
+}
+
+VOID Reuse_Init()
+{
+    LineShift = 0;
+    while ( (2U << LineShift) <= KnobReuseLine.Value() )
+        LineShift++;
+    SampleRate = std::max(KnobReuseSample.Value(), 1U);
+
+    RefBuffer = PIN_DefineTraceBuffer(sizeof(reuse_ref_t), REUSE_BUFFER_PAGES, Reuse_BufferFull, 0);
+    if ( RefBuffer == BUFFER_ID_INVALID )
+        ERROR("Failed to define the reuse reference buffer");
+}
+
+VOID Reuse_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    reuse_thread_t* rt = new reuse_thread_t();
+    rt->_tree.resize(REUSE_MIN_CAPACITY + 1);
+    get_tls(threadid)->_tool = rt;
+}
+
+static inline VOID Reuse_Add(std::vector<UINT64> &tree, UINT64 i, INT64 delta)
+{
+    for (; i < tree.size(); i += i & (~i + 1))
+        tree[i] += delta;
+}
+
+// Number of marks at or before a timestamp
+static inline UINT64 Reuse_Prefix(const std::vector<UINT64> &tree, UINT64 i)
+{
+    UINT64 sum = 0;
+    for (; i; i &= i - 1)
+        sum += tree[i];
+    return sum;
+}
+
+// Renumber the live timestamps 1..n and rebuild the tree with room to grow
+static VOID Reuse_Compact(reuse_thread_t* rt)
+{
+    std::vector< std::pair<UINT64, ADDRINT> > live;
+    live.reserve(rt->_last.size());
+    for (std::map<ADDRINT, UINT64>::iterator it = rt->_last.begin(); it != rt->_last.end(); ++it)
+        live.push_back(std::make_pair(it->second, it->first));
+    std::sort(live.begin(), live.end());
+
+    UINT64 capacity = std::max((UINT64)REUSE_MIN_CAPACITY, 2 * (UINT64)live.size());
+    rt->_tree.assign(capacity + 1, 0);
+    for (UINT64 i = 0; i < live.size(); i++)
+    {
+        rt->_last[live[i].second] = i + 1;
+        rt->_tree[i + 1] = 1;
+    }
+
+    // Linear build, each node adds itself to its parent
+    for (UINT64 i = 1; i <= capacity; i++)
+    {
+        UINT64 parent = i + (i & (~i + 1));
+        if ( parent <= capacity )
+            rt->_tree[parent] += rt->_tree[i];
+    }
+    rt->_time = live.size();
+}
+
+static inline UINT32 Reuse_Bucket(UINT64 distance)
+{
+    UINT32 bucket = 0;
+    while ( distance && bucket < REUSE_BUCKETS - 1 )
+    {
+        distance >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static VOID Reuse_Access(reuse_thread_t* rt, ADDRINT line, UINT32 rtn)
+{
+    if ( SampleRate > 1 && ((line * 0x9E3779B97F4A7C15ULL) >> 40) % SampleRate )
+        return;
+
+    if ( rt->_time + 1 >= rt->_tree.size() )
+        Reuse_Compact(rt);
+    UINT64 now = ++rt->_time;
+
+    UINT32 bucket = REUSE_COLD;
+    std::map<ADDRINT, UINT64>::iterator it = rt->_last.find(line);
+    if ( it != rt->_last.end() )
+    {
+        UINT64 distance = rt->_last.size() - Reuse_Prefix(rt->_tree, it->second);
+        bucket = Reuse_Bucket(distance * SampleRate);
+        Reuse_Add(rt->_tree, it->second, -1);
+        it->second = now;
+    }
+    else
+        rt->_last[line] = now;
+    Reuse_Add(rt->_tree, now, 1);
+
+    rt->_histogram._buckets[bucket]++;
+    if ( rtn != REUSE_NO_RTN )
+        rt->_rtnHistograms[rtn]._buckets[bucket]++;
+}
+
+VOID* Reuse_BufferFull(BUFFER_ID id, THREADID threadid, const CONTEXT *ctxt, VOID *buf, UINT64 numElements, VOID *v)
+{
+    reuse_thread_t* rt = get_reuse(threadid);
+    const reuse_ref_t *refs = static_cast<const reuse_ref_t*>(buf);
+
+    for (UINT64 i = 0; i < numElements; i++)
+    {
+        // Unaligned references may touch two lines
+        ADDRINT first = refs[i]._address >> LineShift;
+        ADDRINT last = (refs[i]._address + std::max(refs[i]._size, 1U) - 1) >> LineShift;
+        for (ADDRINT line = first; line <= last; line++)
+            Reuse_Access(rt, line, refs[i]._rtn);
+    }
+    return buf;
+}
+
+VOID Reuse_Trace(TRACE trace, VOID *v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if ( !Filter_Bbl(bbl) )
+            continue;
+
+        RTN rtn = RTN_FindByAddress(BBL_Address(bbl));
+        UINT32 id = RTN_Valid(rtn) ? Proccount_RtnId(rtn) : REUSE_NO_RTN;
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            if ( INS_IsPrefetch(ins) )
+                continue;
+
+            for (UINT32 op = 0; op < INS_MemoryOperandCount(ins); op++)
+            {
+                INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, RefBuffer,
+                                               IARG_MEMORYOP_EA, op, offsetof(reuse_ref_t, _address),
+                                               IARG_UINT32, INS_MemoryOperandSize(ins, op), offsetof(reuse_ref_t, _size),
+                                               IARG_UINT32, id, offsetof(reuse_ref_t, _rtn),
+                                               IARG_END);
+            }
+        }
+    }
+}
+
+// Miss ratio curve of a histogram: for each power of two cache size the
+// share of accesses whose distance does not fit
+static VOID Reuse_Curve(const string &name, const reuse_histogram_t &histogram)
+{
+    UINT64 total = 0;
+    for (UINT32 b = 0; b <= REUSE_COLD; b++)
+        total += histogram._buckets[b];
+    if ( !total )
+        return;
+
+    // A cache of 2^b lines hits the distances of buckets 0..b
+    UINT64 hits = 0;
+    for (UINT32 b = 0; b < REUSE_BUCKETS; b++)
+    {
+        hits += histogram._buckets[b];
+        OutFile << name << "," << b << "," << ((UINT64)1 << (b + LineShift)) << "," << histogram._buckets[b] << ","
+                << (double)(total - hits) / total << endl;
+    }
+    OutFile << name << ",cold,," << histogram._buckets[REUSE_COLD] << "," << endl;
+}
+
+static bool Reuse_CompareRtns(const std::pair<UINT64, UINT32> &a, const std::pair<UINT64, UINT32> &b)
+{
+    return a.first > b.first;
+}
+
+VOID Reuse_Fini(INT32 code, VOID *v)
+{
+    reuse_histogram_t total;
+    memset(&total, 0, sizeof(total));
+    for (INT32 t = 0; t < numThreads; t++)
+    {
+        for (UINT32 b = 0; b <= REUSE_COLD; b++)
+            total._buckets[b] += get_reuse(t)->_histogram._buckets[b];
+    }
+
+    // Top routines by accesses
+    std::vector<reuse_histogram_t> rtns(RtnTable.size());
+    std::vector< std::pair<UINT64, UINT32> > hot;
+    for (UINT32 id = 0; id < RtnTable.size(); id++)
+    {
+        UINT64 accesses = 0;
+        for (INT32 t = 0; t < numThreads; t++)
+        {
+            const reuse_histogram_t *h = get_reuse(t)->_rtnHistograms.find(id);
+            if ( !h )
+                continue;
+            for (UINT32 b = 0; b <= REUSE_COLD; b++)
+            {
+                rtns[id]._buckets[b] += h->_buckets[b];
+                accesses += h->_buckets[b];
+            }
+        }
+        if ( accesses )
+            hot.push_back(std::make_pair(accesses, id));
+    }
+    UINT32 topN = std::min((size_t)KnobTopN.Value(), hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + topN, hot.end(), Reuse_CompareRtns);
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    OutFile << "# Line " << (1U << LineShift) << " bytes, one in " << SampleRate << " lines tracked" << endl;
+    OutFile << "Scope,Bucket,CacheBytes,Accesses,MissRatio" << endl;
+    Reuse_Curve("total", total);
+    for (INT32 t = 0; t < numThreads; t++)
+        Reuse_Curve("thread " + decstr(t), get_reuse(t)->_histogram);
+    for (UINT32 i = 0; i < topN; i++)
+        Reuse_Curve("\"" + RtnTable[hot[i].second]->_name + "\"", rtns[hot[i].second]);
+
+    Filter_Report(OutFile);
+    OutFile.close();
+    ReleaseLock(&OutFileLock);
+}
@@ -0,0 +1,93 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_REUSE_H
+#define MEMPIN_REUSE_H
+
+//
+// Tool entry points
+//
+
+BOOL reuse(INT32 toolId);
+
+// Power of two distance buckets, bucket 0 is distance 0, bucket b holds
+// [2^(b-1), 2^b) and the last one counts cold accesses
+#define REUSE_BUCKETS 48
+#define REUSE_COLD REUSE_BUCKETS
+
+// Smallest timestamp range of the Fenwick tree
+#define REUSE_MIN_CAPACITY (1 << 20)
+
+// Pages of each per-thread reference buffer
+#define REUSE_BUFFER_PAGES 64
+
+// Routine id of references outside of any known routine
+#define REUSE_NO_RTN 0xffffffff
+
+// Memory reference as recorded in the trace buffer
+typedef struct ReuseRef
+{
+    ADDRINT _address;
+    UINT32 _size;
+    UINT32 _rtn;                // proccount routine id
+} reuse_ref_t;
+
+typedef struct ReuseHistogram
+{
+    UINT64 _buckets[REUSE_BUCKETS + 1];
+} reuse_histogram_t;
+
+// Per-thread state, kept in thread_data_t::_tool
+typedef struct ReuseThread
+{
+    UINT64 _time;                       // timestamp of the last access
+    std::map<ADDRINT, UINT64> _last;    // last access of each line
+    std::vector<UINT64> _tree;          // Fenwick tree over timestamps
+    reuse_histogram_t _histogram;
+    chunked_table_t<reuse_histogram_t> _rtnHistograms;
+} reuse_thread_t;
+
+/** Sets up the reference buffer */
+VOID Reuse_Init();
+
+/** Thread start callback, sets up the per-thread state */
+VOID Reuse_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
+
+/** Computes the reuse distances of a full reference buffer */
+VOID* Reuse_BufferFull(BUFFER_ID id, THREADID threadid, const CONTEXT *ctxt, VOID *buf, UINT64 numElements, VOID *v);
+
+/** Trace instrumentation, records all memory operands */
+VOID Reuse_Trace(TRACE trace, VOID *v);
+
+/** Finish callback */
+VOID Reuse_Fini(INT32 code, VOID *v);
+
+#endif // MEMPIN_REUSE_H
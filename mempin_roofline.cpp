@@ -0,0 +1,325 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_roofline.h"
+
+KNOB<UINT32> KnobRooflineGflops(KNOB_MODE_WRITEONCE, "pintool",
+    "roof_gflops", "0", "peak GFLOP/s of the machine, with -roof_gbs tells memory from compute bound routines.");
+
+KNOB<UINT32> KnobRooflineGbs(KNOB_MODE_WRITEONCE, "pintool",
+    "roof_gbs", "0", "peak memory bandwidth of the machine in GB/s.");
+
+//
+// Tool Registration
+//
+
+BOOL roofline(INT32 toolId)
+{
+    if ( toolId == TOOL_ROOFLINE )
+    {
+        LOGI("Registering callbacks for roofline");
+
+        // Per-thread counters of inscount
+        Inscount_Init();
+
+        // Routine ids and calls come from proccount
+        RTN_AddInstrumentFunction(Proccount_Instruction, 0);
+
+        PIN_AddThreadStartFunction(Roofline_ThreadStart, 0);
+        TRACE_AddInstrumentFunction(Roofline_Trace, 0);
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(Roofline_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// Roofline implementation
+//
+// Each BBL adds its instructions, floating point operations and the
+// bytes of its memory operands to the routine it belongs to, in one call.
+// Predicated instructions (cmov, rep movs) add their bytes on their own,
+// only when they run.
+//
+// FLOPs come from the mnemonic and the vector width of Inscount_Classify:
+// packed arithmetic does one operation per element, scalar one, and fused
+// multiply-add two. Moves, shuffles, logic and integer SIMD do none.
+// Write masks of AVX-512 are not taken into account.
+//
+// The bytes are those of the memory operands, so the intensity is the one
+// against the first cache level, an upper bound for the DRAM roofline.
+
+static roofline_thread_t* get_roofline(THREADID threadid)
+{
+    return static_cast<roofline_thread_t*>(get_tls(threadid)->_tool);
+}
+
+VOID Roofline_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    get_tls(threadid)->_tool = new roofline_thread_t();
+}
+
+// Arithmetic mnemonics, without the V prefix of AVX and the type suffix
+static const char* RooflineOps[] = {
+    "ADD", "SUB", "MUL", "DIV", "SQRT", "MIN", "MAX", "HADD", "HSUB", "ADDSUB", "RCP", "RSQRT"
+};
+
+static const char* RooflineFmaOps[] = {
+    "FMADD", "FMSUB", "FNMADD", "FNMSUB", "FMADDSUB", "FMSUBADD"
+};
+
+static BOOL Roofline_Match(const string &op, const char **ops, UINT32 count)
+{
+    for (UINT32 i = 0; i < count; i++)
+    {
+        if ( op == ops[i] )
+            return TRUE;
+    }
+    return FALSE;
+}
+
+UINT32 Roofline_Flops(INS ins)
+{
+    UINT32 width;
+    UINT32 mix = Inscount_Classify(ins, &width);
+    if ( mix == MIX_NONE )
+        return 0;
+
+    string mnemonic = INS_Mnemonic(ins);
+
+    // x87: fadd, fsubr, fmulp, fdiv, fsqrt...
+    if ( mix == MIX_SCALAR_FP && mnemonic[0] == 'F' )
+    {
+        static const char* x87[] = { "FADD", "FSUB", "FMUL", "FDIV", "FSQRT" };
+        for (UINT32 i = 0; i < sizeof(x87) / sizeof(x87[0]); i++)
+        {
+            if ( mnemonic.compare(0, strlen(x87[i]), x87[i]) == 0 )
+                return 1;
+        }
+        return 0;
+    }
+
+    // The suffix gives packed or scalar and the element type
+    if ( mnemonic.size() < 3 )
+        return 0;
+    char packing = mnemonic[mnemonic.size() - 2];
+    char type = mnemonic[mnemonic.size() - 1];
+    UINT32 elementBits = (type == 'S') ? 32 : (type == 'D') ? 64 : (type == 'H') ? 16 : 0;
+    if ( (packing != 'P' && packing != 'S') || !elementBits )
+        return 0;
+
+    string op = mnemonic.substr(mnemonic[0] == 'V' ? 1 : 0);
+    op = op.substr(0, op.size() - 2);
+
+    // vfmadd231ps and friends carry the operand order in the middle
+    while ( !op.empty() && isdigit(op[op.size() - 1]) )
+        op.erase(op.size() - 1);
+
+    UINT32 perElement;
+    if ( Roofline_Match(op, RooflineFmaOps, sizeof(RooflineFmaOps) / sizeof(RooflineFmaOps[0])) )
+        perElement = 2;
+    else if ( Roofline_Match(op, RooflineOps, sizeof(RooflineOps) / sizeof(RooflineOps[0])) )
+        perElement = 1;
+    else
+        return 0;
+
+    UINT32 elements = (packing == 'P' && width) ? width / elementBits : 1;
+    return perElement * elements;
+}
+
+static inline VOID Roofline_Count(roofline_thread_t* rt, UINT32 id, UINT32 numIns, UINT32 flops, UINT32 loadBytes, UINT32 storeBytes)
+{
+    roofline_rtn_t &rtn = rt->_rtns[id];
+    rtn._instructions += numIns;
+    rtn._flops += flops;
+    rtn._loadBytes += loadBytes;
+    rtn._storeBytes += storeBytes;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL roofline_count(UINT32 id, UINT32 numIns, UINT32 flops, UINT32 loadBytes, UINT32 storeBytes, THREADID threadid)
+{
+    Roofline_Count(get_roofline(threadid), id, numIns, flops, loadBytes, storeBytes);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL roofline_count_reg(UINT32 id, UINT32 numIns, UINT32 flops, UINT32 loadBytes, UINT32 storeBytes, thread_data_t* tdata)
+{
+    Roofline_Count(static_cast<roofline_thread_t*>(tdata->_tool), id, numIns, flops, loadBytes, storeBytes);
+}
+
+// Bytes of the memory operands of an instruction
+static VOID Roofline_Bytes(INS ins, UINT32 *loadBytes, UINT32 *storeBytes)
+{
+    for (UINT32 op = 0; op < INS_MemoryOperandCount(ins); op++)
+    {
+        if ( INS_MemoryOperandIsRead(ins, op) )
+            *loadBytes += INS_MemoryOperandSize(ins, op);
+        if ( INS_MemoryOperandIsWritten(ins, op) )
+            *storeBytes += INS_MemoryOperandSize(ins, op);
+    }
+}
+
+VOID Roofline_Trace(TRACE trace, VOID *v)
+{
+    REG reg = Inscount_ToolReg();
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if ( !Filter_Bbl(bbl) )
+            continue;
+
+        RTN rtn = RTN_FindByAddress(BBL_Address(bbl));
+        if ( !RTN_Valid(rtn) )
+            continue;
+
+        UINT32 id = Proccount_RtnId(rtn);
+        UINT32 flops = 0, loadBytes = 0, storeBytes = 0;
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            if ( !INS_IsPredicated(ins) )
+            {
+                flops += Roofline_Flops(ins);
+                Roofline_Bytes(ins, &loadBytes, &storeBytes);
+                continue;
+            }
+
+            // Predicated instructions only count when they execute
+            UINT32 predFlops = Roofline_Flops(ins), predLoads = 0, predStores = 0;
+            Roofline_Bytes(ins, &predLoads, &predStores);
+            if ( !predFlops && !predLoads && !predStores )
+                continue;
+
+            if ( REG_valid(reg) )
+                INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)roofline_count_reg, IARG_FAST_ANALYSIS_CALL,
+                                         IARG_UINT32, id, IARG_UINT32, 0, IARG_UINT32, predFlops, IARG_UINT32, predLoads,
+                                         IARG_UINT32, predStores, IARG_REG_VALUE, reg, IARG_END);
+            else
+                INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)roofline_count, IARG_FAST_ANALYSIS_CALL,
+                                         IARG_UINT32, id, IARG_UINT32, 0, IARG_UINT32, predFlops, IARG_UINT32, predLoads,
+                                         IARG_UINT32, predStores, IARG_THREAD_ID, IARG_END);
+        }
+
+        if ( REG_valid(reg) )
+            BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)roofline_count_reg, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, id, IARG_UINT32, BBL_NumIns(bbl), IARG_UINT32, flops, IARG_UINT32, loadBytes,
+                           IARG_UINT32, storeBytes, IARG_REG_VALUE, reg, IARG_END);
+        else
+            BBL_InsertCall(bbl, IPOINT_ANYWHERE, (AFUNPTR)roofline_count, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, id, IARG_UINT32, BBL_NumIns(bbl), IARG_UINT32, flops, IARG_UINT32, loadBytes,
+                           IARG_UINT32, storeBytes, IARG_THREAD_ID, IARG_END);
+    }
+}
+
+// Order routines by dynamic instruction count, highest first
+static bool Roofline_Compare(const std::pair<UINT64, UINT32> &a, const std::pair<UINT64, UINT32> &b)
+{
+    return a.first > b.first;
+}
+
+static VOID Roofline_Row(const roofline_rtn_t &r, double ridge)
+{
+    // Without any bytes moved the intensity is unbounded, left empty
+    UINT64 bytes = r._loadBytes + r._storeBytes;
+    OutFile << r._instructions << "," << r._flops << "," << r._loadBytes << "," << r._storeBytes << ",";
+    if ( bytes )
+        OutFile << (double)r._flops / bytes;
+    OutFile << ",";
+    if ( r._flops && !bytes )
+        OutFile << "compute";
+    else if ( ridge > 0 && r._flops )
+        OutFile << ((double)r._flops / bytes < ridge ? "memory" : "compute");
+}
+
+// This function is called when the application exits
+VOID Roofline_Fini(INT32 code, VOID *v)
+{
+    // Merge the counters of all threads
+    std::vector<roofline_rtn_t> rtns(RtnTable.size());
+    std::vector<UINT64> calls(RtnTable.size(), 0);
+    roofline_rtn_t total;
+    memset(&total, 0, sizeof(total));
+    for (INT32 t = 0; t < numThreads; t++)
+    {
+        roofline_thread_t* rt = get_roofline(t);
+        for (UINT32 id = 0; id < RtnTable.size(); id++)
+        {
+            calls[id] += get_tls(t)->_rtnCalls.get(id);
+            const roofline_rtn_t *r = rt->_rtns.find(id);
+            if ( !r )
+                continue;
+
+            rtns[id]._instructions += r->_instructions;
+            rtns[id]._flops += r->_flops;
+            rtns[id]._loadBytes += r->_loadBytes;
+            rtns[id]._storeBytes += r->_storeBytes;
+        }
+    }
+
+    std::vector< std::pair<UINT64, UINT32> > hot;
+    for (UINT32 id = 0; id < RtnTable.size(); id++)
+    {
+        total._instructions += rtns[id]._instructions;
+        total._flops += rtns[id]._flops;
+        total._loadBytes += rtns[id]._loadBytes;
+        total._storeBytes += rtns[id]._storeBytes;
+        if ( rtns[id]._instructions )
+            hot.push_back(std::make_pair(rtns[id]._instructions, id));
+    }
+    UINT32 topN = std::min((size_t)KnobTopN.Value(), hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + topN, hot.end(), Roofline_Compare);
+
+    // Intensity where the bandwidth roof meets the compute roof
+    double ridge = KnobRooflineGbs.Value() ? (double)KnobRooflineGflops.Value() / KnobRooflineGbs.Value() : 0;
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    OutFile << "Rank,Procedure,Image,Address,Calls,Instructions,Flops,LoadBytes,StoreBytes,Intensity,Bound" << endl;
+    for (UINT32 i = 0; i < topN; i++)
+    {
+        UINT32 id = hot[i].second;
+        OutFile << i+1 << "," << RtnTable[id]->_name << "," << RtnTable[id]->_image << ","
+                << hexstr(RtnTable[id]->_address) << "," << calls[id] << ",";
+        Roofline_Row(rtns[id], ridge);
+        OutFile << endl;
+    }
+    OutFile << "Total,,,,,";
+    Roofline_Row(total, ridge);
+    OutFile << endl;
+
+    if ( ridge > 0 )
+        OutFile << endl << "PeakGflops,PeakGBs,RidgeIntensity" << endl
+                << KnobRooflineGflops.Value() << "," << KnobRooflineGbs.Value() << "," << ridge << endl;
+
+    Filter_Report(OutFile);
+    OutFile.close();
+    ReleaseLock(&OutFileLock);
+}
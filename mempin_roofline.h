@@ -0,0 +1,68 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_ROOFLINE_H
+#define MEMPIN_ROOFLINE_H
+
+//
+// Tool entry points
+//
+
+BOOL roofline(INT32 toolId);
+
+// Counters of one routine in one thread
+typedef struct RooflineRtn
+{
+    UINT64 _instructions;
+    UINT64 _flops;
+    UINT64 _loadBytes;
+    UINT64 _storeBytes;
+} roofline_rtn_t;
+
+// Per-thread state, kept in thread_data_t::_tool
+typedef struct RooflineThread
+{
+    chunked_table_t<roofline_rtn_t> _rtns;
+} roofline_thread_t;
+
+/** Thread start callback, sets up the routine counters */
+VOID Roofline_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
+
+/** Floating point operations of one execution of the instruction */
+UINT32 Roofline_Flops(INS ins);
+
+/** Trace instrumentation, counts FLOPs and bytes of each BBL for its routine */
+VOID Roofline_Trace(TRACE trace, VOID *v);
+
+/** Finish callback */
+VOID Roofline_Fini(INT32 code, VOID *v);
+
+#endif // MEMPIN_ROOFLINE_H
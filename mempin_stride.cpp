@@ -0,0 +1,268 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_stride.h"
+
+#include <set>
+
+//
+// Tool Registration
+//
+
+BOOL stride(INT32 toolId)
+{
+    if ( toolId == TOOL_STRIDE )
+    {
+        LOGI("Registering callbacks for stride");
+
+        // Per-thread data of inscount
+        Inscount_Init();
+
+        PIN_AddThreadStartFunction(Stride_ThreadStart, 0);
+        TRACE_AddInstrumentFunction(Stride_Trace, 0);
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(Stride_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// Stride implementation
+//
+// Every static memory operand gets an id and each thread keeps a history
+// entry per id: the last address, the current stride and a saturating
+// confidence counter. An execution that repeats the stride is fixed (or
+// unit) stride, anything else is irregular. The stride is only replaced
+// once the confidence ran out, so the jump at the end of a row does not
+// throw away the stride of a loop nest.
+//
+// Pointer chasing is found statically: a load whose base register was
+// loaded from memory earlier in the same block, or by itself as in
+// p = p->next. Stack accesses are left out.
+
+static const char* StridePatternNames[STRIDE_PATTERNS] = { "Constant", "Unit", "Fixed", "Irregular" };
+
+// Static memory operands by id, only grows at instrumentation time
+static std::vector<stride_ins_t> StrideTable;
+
+// Id of each memory operand, so a retranslated instruction keeps its id
+static std::map<std::pair<ADDRINT, UINT32>, UINT32> StrideIds;
+
+static stride_thread_t* get_stride(THREADID threadid)
+{
+    return static_cast<stride_thread_t*>(get_tls(threadid)->_tool);
+}
+
+VOID Stride_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    get_tls(threadid)->_tool = new stride_thread_t();
+}
+
+static inline VOID Stride_Access(stride_thread_t* st, UINT32 id, ADDRINT address, UINT32 size)
+{
+    stride_entry_t &entry = st->_entries[id];
+    if ( entry._count++ )
+    {
+        INT64 delta = (INT64)(address - entry._last);
+        UINT32 pattern = STRIDE_IRREGULAR;
+        if ( delta == 0 )
+            pattern = STRIDE_CONSTANT;
+        else if ( delta == entry._stride )
+            pattern = (UINT64)(delta < 0 ? -delta : delta) <= size ? STRIDE_UNIT : STRIDE_FIXED;
+        entry._patterns[pattern]++;
+
+        if ( delta == entry._stride )
+            entry._confidence = std::min(entry._confidence + 1, (UINT32)STRIDE_MAX_CONFIDENCE);
+        else if ( entry._confidence )
+            entry._confidence--;
+        else
+            entry._stride = delta;
+    }
+    entry._last = address;
+}
+
+VOID stride_access(UINT32 id, ADDRINT address, UINT32 size, THREADID threadid)
+{
+    Stride_Access(get_stride(threadid), id, address, size);
+}
+
+VOID stride_access_reg(UINT32 id, ADDRINT address, UINT32 size, thread_data_t* tdata)
+{
+    Stride_Access(static_cast<stride_thread_t*>(tdata->_tool), id, address, size);
+}
+
+VOID Stride_Trace(TRACE trace, VOID *v)
+{
+    REG reg = Inscount_ToolReg();
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if ( !Filter_Bbl(bbl) )
+            continue;
+
+        // Registers that currently hold a value loaded from memory
+        std::set<REG> loaded;
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            BOOL stack = INS_IsStackRead(ins) || INS_IsStackWrite(ins) || INS_IsPrefetch(ins);
+            REG base = INS_MemoryBaseReg(ins);
+            BOOL chase = REG_valid(base) && (loaded.count(REG_FullRegName(base)) || INS_RegWContain(ins, base));
+
+            for (UINT32 op = 0; op < INS_MemoryOperandCount(ins) && !stack; op++)
+            {
+                std::pair<ADDRINT, UINT32> key(INS_Address(ins), op);
+                std::map<std::pair<ADDRINT, UINT32>, UINT32>::iterator it = StrideIds.find(key);
+                UINT32 id;
+
+                if ( it != StrideIds.end() )
+                {
+                    // A trace starting elsewhere may see the base loaded
+                    id = it->second;
+                    StrideTable[id]._pointerChase |= StrideTable[id]._isLoad && chase;
+                }
+                else
+                {
+                    if ( StrideTable.size() >= COUNTER_MAX_ID )
+                        break;
+
+                    stride_ins_t si;
+                    si._address = key.first;
+                    si._size = INS_MemoryOperandSize(ins, op);
+                    si._isLoad = INS_MemoryOperandIsRead(ins, op);
+                    si._pointerChase = si._isLoad && chase;
+                    id = StrideTable.size();
+                    StrideTable.push_back(si);
+                    SourceLocation_Record(si._address);
+                    StrideIds[key] = id;
+                }
+
+                if ( REG_valid(reg) )
+                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)stride_access_reg,
+                                             IARG_UINT32, id, IARG_MEMORYOP_EA, op, IARG_UINT32, StrideTable[id]._size,
+                                             IARG_REG_VALUE, reg, IARG_END);
+                else
+                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)stride_access,
+                                             IARG_UINT32, id, IARG_MEMORYOP_EA, op, IARG_UINT32, StrideTable[id]._size,
+                                             IARG_THREAD_ID, IARG_END);
+            }
+
+            // Follow the loaded values through the block
+            for (UINT32 w = 0; w < INS_MaxNumWRegs(ins); w++)
+            {
+                REG written = REG_FullRegName(INS_RegW(ins, w));
+                if ( INS_IsMemoryRead(ins) && !stack )
+                    loaded.insert(written);
+                else
+                    loaded.erase(written);
+            }
+        }
+    }
+}
+
+static bool Stride_Compare(const std::pair<UINT64, UINT32> &a, const std::pair<UINT64, UINT32> &b)
+{
+    return a.first > b.first;
+}
+
+VOID Stride_Fini(INT32 code, VOID *v)
+{
+    std::vector<stride_entry_t> entries(StrideTable.size());
+    std::vector<UINT64> strideCount(StrideTable.size(), 0);
+    UINT64 totals[STRIDE_PATTERNS] = { 0 };
+
+    for (INT32 t = 0; t < numThreads; t++)
+    {
+        stride_thread_t* st = get_stride(t);
+        for (UINT32 id = 0; id < StrideTable.size(); id++)
+        {
+            const stride_entry_t *e = st->_entries.find(id);
+            if ( !e || !e->_count )
+                continue;
+
+            // The stride of the thread that ran it most
+            if ( e->_count > strideCount[id] )
+            {
+                strideCount[id] = e->_count;
+                entries[id]._stride = e->_stride;
+            }
+            entries[id]._count += e->_count;
+            for (UINT32 p = 0; p < STRIDE_PATTERNS; p++)
+            {
+                entries[id]._patterns[p] += e->_patterns[p];
+                totals[p] += e->_patterns[p];
+            }
+        }
+    }
+
+    // Loads by irregular executions, where prefetching or a new layout pays
+    std::vector< std::pair<UINT64, UINT32> > hot;
+    for (UINT32 id = 0; id < StrideTable.size(); id++)
+    {
+        if ( StrideTable[id]._isLoad && entries[id]._patterns[STRIDE_IRREGULAR] )
+            hot.push_back(std::make_pair(entries[id]._patterns[STRIDE_IRREGULAR], id));
+    }
+    UINT32 topN = std::min((size_t)KnobTopN.Value(), hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + topN, hot.end(), Stride_Compare);
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    OutFile << "Pattern,Executions" << endl;
+    for (UINT32 p = 0; p < STRIDE_PATTERNS; p++)
+        OutFile << StridePatternNames[p] << "," << totals[p] << endl;
+
+    OutFile << endl << "Rank,Ip,Executions,Constant,Unit,Fixed,Irregular,Pattern,Stride,PointerChase,"
+            << SOURCE_LOCATION_HEADER << endl;
+    for (UINT32 i = 0; i < topN; i++)
+    {
+        UINT32 id = hot[i].second;
+        stride_entry_t &e = entries[id];
+
+        UINT32 pattern = 0;
+        for (UINT32 p = 1; p < STRIDE_PATTERNS; p++)
+        {
+            if ( e._patterns[p] > e._patterns[pattern] )
+                pattern = p;
+        }
+
+        OutFile << i+1 << "," << hexstr(StrideTable[id]._address) << "," << e._count;
+        for (UINT32 p = 0; p < STRIDE_PATTERNS; p++)
+            OutFile << "," << e._patterns[p];
+        OutFile << "," << StridePatternNames[pattern] << "," << e._stride << ","
+                << (StrideTable[id]._pointerChase ? "yes" : "no") << "," << SourceLocation(StrideTable[id]._address) << endl;
+    }
+
+    Filter_Report(OutFile);
+    OutFile.close();
+    ReleaseLock(&OutFileLock);
+}
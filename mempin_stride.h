@@ -0,0 +1,85 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_STRIDE_H
+#define MEMPIN_STRIDE_H
+
+//
+// Tool entry points
+//
+
+BOOL stride(INT32 toolId);
+
+// Address patterns of an instruction, per execution
+#define STRIDE_CONSTANT 0       // same address as last time
+#define STRIDE_UNIT 1           // next element, stride no larger than the access
+#define STRIDE_FIXED 2          // same stride as last time
+#define STRIDE_IRREGULAR 3
+#define STRIDE_PATTERNS 4
+
+// Confidence counter saturates here
+#define STRIDE_MAX_CONFIDENCE 3
+
+// Static memory operand
+typedef struct StrideIns
+{
+    ADDRINT _address;
+    UINT32 _size;
+    BOOL _isLoad;
+    BOOL _pointerChase;         // base register comes from a load
+} stride_ins_t;
+
+// History of one memory operand in one thread
+typedef struct StrideEntry
+{
+    ADDRINT _last;
+    INT64 _stride;
+    UINT32 _confidence;
+    UINT64 _count;
+    UINT64 _patterns[STRIDE_PATTERNS];
+} stride_entry_t;
+
+// Per-thread state, kept in thread_data_t::_tool
+typedef struct StrideThread
+{
+    chunked_table_t<stride_entry_t> _entries;
+} stride_thread_t;
+
+/** Thread start callback, sets up the history table */
+VOID Stride_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
+
+/** Trace instrumentation, hooks all memory operands */
+VOID Stride_Trace(TRACE trace, VOID *v);
+
+/** Finish callback */
+VOID Stride_Fini(INT32 code, VOID *v);
+
+#endif // MEMPIN_STRIDE_H
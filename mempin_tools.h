@@ -38,12 +38,38 @@
 #define TOOL_INSCOUNT_EXT 2
 #define TOOL_PROCCOUNT 3
 #define TOOL_MALLOCTRACE 4
-
-// TODO: Add memory foot print tools
+#define TOOL_BBLPROF 5
+#define TOOL_CALLGRAPH 6
+#define TOOL_OBJPROF 7
+#define TOOL_FOOTPRINT 8
+#define TOOL_CACHESIM 9
+#define TOOL_FALSESHARE 10
+#define TOOL_REUSE 11
+#define TOOL_WORKINGSET 12
+#define TOOL_STRIDE 13
+#define TOOL_NUMA 14
+#define TOOL_LOCKPROF 15
+#define TOOL_BRANCHSIM 16
+#define TOOL_LOOPPROF 17
+#define TOOL_ROOFLINE 18
 
 /** Include all MemPin tools */
 #include "mempin_inscount.h"
 #include "mempin_proccount.h"
 #include "mempin_malloctrace.h"
+#include "mempin_bblprof.h"
+#include "mempin_callgraph.h"
+#include "mempin_objprof.h"
+#include "mempin_footprint.h"
+#include "mempin_cachesim.h"
+#include "mempin_falseshare.h"
+#include "mempin_reuse.h"
+#include "mempin_workingset.h"
+#include "mempin_stride.h"
+#include "mempin_numa.h"
+#include "mempin_lockprof.h"
+#include "mempin_branchsim.h"
+#include "mempin_loopprof.h"
+#include "mempin_roofline.h"
 
 #endif // MEMPIN_TOOLS_H
\ No newline at end of file
@@ -37,4 +37,20 @@
 #define WARN(x) cerr << "WARNING: " << x << endl;
 #define ERROR(x) cerr << "ERROR: " << x << endl;
 
+// Monotonic wall clock in milliseconds
+inline UINT64 GetTimeMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Monotonic wall clock in nanoseconds
+inline UINT64 GetTimeNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 #endif // MEMPIN_UTILS_H
\ No newline at end of file
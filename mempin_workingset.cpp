@@ -0,0 +1,286 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+/** MemPin includes */
+#include "mempin.h"
+#include "mempin_workingset.h"
+
+KNOB<UINT64> KnobWorkingsetInterval(KNOB_MODE_WRITEONCE, "pintool",
+    "ws_interval", "10000000", "instructions of a thread per working set interval.");
+
+static UINT64 Interval = 0;
+
+//
+// Tool Registration
+//
+
+BOOL workingset(INT32 toolId)
+{
+    if ( toolId == TOOL_WORKINGSET )
+    {
+        LOGI("Registering callbacks for workingset");
+
+        // Per-thread data of inscount
+        Inscount_Init();
+        Interval = std::max(KnobWorkingsetInterval.Value(), (UINT64)1);
+
+        PIN_AddThreadStartFunction(Workingset_ThreadStart, 0);
+        TRACE_AddInstrumentFunction(Workingset_Trace, 0);
+
+        // Register Fini to be called when the application exits.
+        PIN_AddFiniFunction(Workingset_Fini, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//
+// Working set implementation
+//
+// Every thread marks the lines it touches in its own shadow bitmap, so
+// marking needs no lock. A region of the bitmap holds two masks per page,
+// one for the current interval and one for the whole run. The first mark
+// of a page in an interval puts its mask on a dirty list, closing the
+// interval only clears the masks on that list.
+
+static workingset_thread_t* get_workingset(THREADID threadid)
+{
+    return static_cast<workingset_thread_t*>(get_tls(threadid)->_tool);
+}
+
+VOID Workingset_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    workingset_thread_t* wt = new workingset_thread_t();
+    wt->_intervalEnd = Interval;
+    wt->_regions = new workingset_region_t*[WORKINGSET_REGIONS]();
+    get_tls(threadid)->_tool = wt;
+}
+
+// Record the interval and start a new one
+static VOID Workingset_Close(workingset_thread_t* wt)
+{
+    workingset_sample_t sample;
+    sample._start = wt->_intervalEnd - Interval;
+    sample._pages = wt->_pages;
+    sample._lines = wt->_lines;
+    sample._totalPages = wt->_totalPages;
+    sample._totalLines = wt->_totalLines;
+    wt->_samples.push_back(sample);
+
+    for (UINT32 i = 0; i < wt->_dirty.size(); i++)
+        *wt->_dirty[i] = 0;
+    wt->_dirty.clear();
+    wt->_pages = 0;
+    wt->_lines = 0;
+    wt->_intervalEnd += Interval;
+}
+
+static inline VOID Workingset_Mark(workingset_thread_t* wt, ADDRINT address)
+{
+    ADDRINT region = address >> WORKINGSET_REGION_BITS;
+    if ( region >= WORKINGSET_REGIONS )
+        return;
+
+    workingset_region_t *&shadow = wt->_regions[region];
+    if ( !shadow )
+        shadow = new workingset_region_t();
+
+    UINT32 page = (address >> WORKINGSET_PAGE_BITS) & (WORKINGSET_PAGES - 1);
+    UINT64 line = 1ULL << ((address >> WORKINGSET_LINE_BITS) & 63);
+
+    UINT64 &mask = shadow->_interval[page];
+    if ( !(mask & line) )
+    {
+        if ( !mask )
+        {
+            wt->_dirty.push_back(&mask);
+            wt->_pages++;
+        }
+        mask |= line;
+        wt->_lines++;
+
+        UINT64 &total = shadow->_total[page];
+        if ( !(total & line) )
+        {
+            wt->_totalPages += !total;
+            total |= line;
+            wt->_totalLines++;
+        }
+    }
+}
+
+static inline VOID Workingset_Access(workingset_thread_t* wt, ADDRINT address, UINT32 size)
+{
+    // The first and last byte cover accesses across a line or page
+    Workingset_Mark(wt, address);
+    if ( size > 1 && ((address ^ (address + size - 1)) >> WORKINGSET_LINE_BITS) )
+        Workingset_Mark(wt, address + size - 1);
+}
+
+static inline VOID Workingset_Count(workingset_thread_t* wt, UINT32 c)
+{
+    wt->_icount += c;
+    while ( wt->_icount >= wt->_intervalEnd )
+        Workingset_Close(wt);
+}
+
+VOID workingset_access(ADDRINT address, UINT32 size, THREADID threadid)
+{
+    Workingset_Access(get_workingset(threadid), address, size);
+}
+
+VOID workingset_access_reg(ADDRINT address, UINT32 size, thread_data_t* tdata)
+{
+    Workingset_Access(static_cast<workingset_thread_t*>(tdata->_tool), address, size);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL workingset_docount(UINT32 c, THREADID threadid)
+{
+    Workingset_Count(get_workingset(threadid), c);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL workingset_docount_reg(UINT32 c, thread_data_t* tdata)
+{
+    Workingset_Count(static_cast<workingset_thread_t*>(tdata->_tool), c);
+}
+
+VOID Workingset_Trace(TRACE trace, VOID *v)
+{
+    REG reg = Inscount_ToolReg();
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if ( !Filter_Bbl(bbl) )
+            continue;
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            for (UINT32 op = 0; op < INS_MemoryOperandCount(ins); op++)
+            {
+                if ( REG_valid(reg) )
+                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)workingset_access_reg,
+                                             IARG_MEMORYOP_EA, op, IARG_UINT32, INS_MemoryOperandSize(ins, op),
+                                             IARG_REG_VALUE, reg, IARG_END);
+                else
+                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)workingset_access,
+                                             IARG_MEMORYOP_EA, op, IARG_UINT32, INS_MemoryOperandSize(ins, op),
+                                             IARG_THREAD_ID, IARG_END);
+            }
+        }
+
+        // Count before the tail, after the accesses inserted above, so they
+        // land in the interval they belong to
+        INS tail = BBL_InsTail(bbl);
+        if ( REG_valid(reg) )
+            INS_InsertCall(tail, IPOINT_BEFORE, (AFUNPTR)workingset_docount_reg, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, BBL_NumIns(bbl), IARG_REG_VALUE, reg, IARG_END);
+        else
+            INS_InsertCall(tail, IPOINT_BEFORE, (AFUNPTR)workingset_docount, IARG_FAST_ANALYSIS_CALL,
+                           IARG_UINT32, BBL_NumIns(bbl), IARG_THREAD_ID, IARG_END);
+    }
+}
+
+// Unique pages, lines and 2 MB pages of the cumulative masks of a region
+static VOID Workingset_Footprint(const UINT64 *masks, UINT64 *footprint)
+{
+    BOOL huge = FALSE;
+    for (UINT32 p = 0; p < WORKINGSET_PAGES; p++)
+    {
+        if ( masks[p] )
+        {
+            footprint[0]++;
+            huge = TRUE;
+            for (UINT64 m = masks[p]; m; m &= m - 1)
+                footprint[1]++;
+        }
+
+        // A 2 MB page ends every 512 small ones
+        if ( ((p + 1) & ((1 << (WORKINGSET_HUGE_BITS - WORKINGSET_PAGE_BITS)) - 1)) == 0 )
+        {
+            footprint[2] += huge;
+            huge = FALSE;
+        }
+    }
+}
+
+VOID Workingset_Fini(INT32 code, VOID *v)
+{
+    // Footprint of each thread and of all threads together, the union of
+    // their bitmaps
+    std::vector< std::vector<UINT64> > footprints(numThreads + 1, std::vector<UINT64>(3, 0));
+    UINT64 *merged = new UINT64[WORKINGSET_PAGES];
+    for (UINT32 r = 0; r < WORKINGSET_REGIONS; r++)
+    {
+        BOOL used = FALSE;
+        memset(merged, 0, WORKINGSET_PAGES * sizeof(UINT64));
+        for (INT32 t = 0; t < numThreads; t++)
+        {
+            workingset_region_t *shadow = get_workingset(t)->_regions[r];
+            if ( !shadow )
+                continue;
+            used = TRUE;
+            Workingset_Footprint(shadow->_total, &footprints[t][0]);
+            for (UINT32 p = 0; p < WORKINGSET_PAGES; p++)
+                merged[p] |= shadow->_total[p];
+        }
+        if ( used )
+            Workingset_Footprint(merged, &footprints[numThreads][0]);
+    }
+    delete[] merged;
+
+    GetLock(&OutFileLock, BASE_LOCK_TAG);
+    OutFile << "Thread,Start,Pages,Lines,Bytes,TotalPages,TotalLines" << endl;
+    for (INT32 t = 0; t < numThreads; t++)
+    {
+        workingset_thread_t* wt = get_workingset(t);
+
+        // The last interval ends with the thread
+        if ( wt->_pages )
+            Workingset_Close(wt);
+
+        for (UINT32 i = 0; i < wt->_samples.size(); i++)
+        {
+            workingset_sample_t &s = wt->_samples[i];
+            OutFile << t << "," << s._start << "," << s._pages << "," << s._lines << ","
+                    << (s._lines << WORKINGSET_LINE_BITS) << "," << s._totalPages << "," << s._totalLines << endl;
+        }
+    }
+
+    OutFile << endl << "Thread,UniquePages,UniqueLines,UniqueHugePages" << endl;
+    for (INT32 t = 0; t <= numThreads; t++)
+    {
+        OutFile << (t < numThreads ? decstr(t) : "all") << "," << footprints[t][0] << ","
+                << footprints[t][1] << "," << footprints[t][2] << endl;
+    }
+
+    Filter_Report(OutFile);
+    OutFile.close();
+    ReleaseLock(&OutFileLock);
+}
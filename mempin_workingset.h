@@ -0,0 +1,90 @@
+/**
+ * This file is part of the mempin project. A specialized pintool for memory tracking and
+ * optimization.
+ *
+ * Copyright (c) 2012, Moritz Wundke
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the owner nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Moritz Wundke BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#ifndef MEMPIN_WORKINGSET_H
+#define MEMPIN_WORKINGSET_H
+
+//
+// Tool entry points
+//
+
+BOOL workingset(INT32 toolId);
+
+// Two-level shadow bitmap: a directory of 1 GB regions over the 47 bit
+// user address space, each region one 64 bit line mask per 4 KB page
+#define WORKINGSET_LINE_BITS 6
+#define WORKINGSET_PAGE_BITS 12
+#define WORKINGSET_HUGE_BITS 21
+#define WORKINGSET_REGION_BITS 30
+#define WORKINGSET_ADDRESS_BITS 47
+#define WORKINGSET_REGIONS (1 << (WORKINGSET_ADDRESS_BITS - WORKINGSET_REGION_BITS))
+#define WORKINGSET_PAGES (1 << (WORKINGSET_REGION_BITS - WORKINGSET_PAGE_BITS))
+
+typedef struct WorkingsetRegion
+{
+    UINT64 _interval[WORKINGSET_PAGES];     // lines touched in this interval
+    UINT64 _total[WORKINGSET_PAGES];        // lines touched ever
+} workingset_region_t;
+
+// One interval of a thread
+typedef struct WorkingsetSample
+{
+    UINT64 _start;              // instructions of the thread
+    UINT64 _pages;
+    UINT64 _lines;
+    UINT64 _totalPages;
+    UINT64 _totalLines;
+} workingset_sample_t;
+
+// Per-thread state, kept in thread_data_t::_tool
+typedef struct WorkingsetThread
+{
+    UINT64 _icount;
+    UINT64 _intervalEnd;
+    UINT64 _pages;
+    UINT64 _lines;
+    UINT64 _totalPages;
+    UINT64 _totalLines;
+    workingset_region_t ** _regions;
+    std::vector<UINT64 *> _dirty;           // interval masks to clear
+    std::vector<workingset_sample_t> _samples;
+} workingset_thread_t;
+
+/** Thread start callback, sets up the shadow bitmap */
+VOID Workingset_ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v);
+
+/** Trace instrumentation, counts instructions and marks touched lines */
+VOID Workingset_Trace(TRACE trace, VOID *v);
+
+/** Finish callback */
+VOID Workingset_Fini(INT32 code, VOID *v);
+
+#endif // MEMPIN_WORKINGSET_H